@@ -0,0 +1,88 @@
+/// Micro benchmarks of the hot kernels, run once at boot on the board
+///
+/// Results are printed on the serial line as CSV, one line per kernel :
+///     BENCH,<kernel>,<iterations>,<total us>,<ns per iteration>
+/// Keep the lines starting with "BENCH," to compare two commits.
+class Bench {
+public:
+  /// Sink for the results, so that the compiler keeps the kernels
+  static volatile unsigned long sink;
+
+  /// Publish stand-in : nothing is sent
+  static bool publish(const char * topic, const char * payload, bool retain)
+  {
+    return true;
+  }
+
+  /// Input event stand-in
+  static bool inputEvent(int index, bool statusInput)
+  {
+    sink += index;
+    return true;
+  }
+
+  /// Run a kernel <iterations> times and print its CSV line
+  template<typename F> static void run(const char * name, unsigned long iterations, F kernel)
+  {
+    unsigned long start = micros();
+    for (unsigned long i = 0; i < iterations; i++)
+      kernel(i);
+    unsigned long elapsed = micros() - start;
+
+    Serial.print("BENCH,"); Serial.print(name); Serial.print(","); Serial.print(iterations); Serial.print(",");
+    Serial.print(elapsed); Serial.print(","); Serial.println(elapsed * 1000UL / iterations);
+  }
+
+  /// Kernels common to all the modes
+  static void common()
+  {
+    bits(32, "32");
+    bits(64, "64");
+    bits(96, "96");
+    bits(128, "128");
+    triggerEvent(32, 1, "32");
+    triggerEvent(64, 1, "64");
+    triggerEvent(32, 3, "3x32");
+    triggerEvent(96, 1, "96");
+    triggerEvent(128, 1, "128");
+  }
+
+  /// InputBits operations (ShiftInput.h) for n bits
+  static void bits(int n, const char * suffix)
+  {
+    byte words = (n + 31) / 32;
+    InputBits a, b;
+    a.reset(words);
+    a.set(n / 2);
+    b.copy(a, words);
+    char name[24];
+
+    snprintf(name, sizeof(name), "bits_equals_%s", suffix);
+    run(name, 1000, [&](unsigned long i) { sink += a.equals(b, words); });
+    snprintf(name, sizeof(name), "bits_copy_%s", suffix);
+    run(name, 1000, [&](unsigned long i) { b.copy(a, words); });
+    snprintf(name, sizeof(name), "bits_set_%s", suffix);
+    run(name, 1000, [&](unsigned long i) { a.set(i % n); });
+    snprintf(name, sizeof(name), "bits_test_%s", suffix);
+    run(name, 1000, [&](unsigned long i) { sink += a.test(i % n); });
+  }
+
+  /// ShiftInput::triggerEvent diffing, with 2 bits changed
+  static void triggerEvent(byte bits, byte branches, const char * suffix)
+  {
+    ShiftInput input(inputEvent, 0, 0, 0, {0, 0, 0});
+    input.configure(bits, branches);
+    byte words = (bits * branches + 31) / 32;
+    InputBits previous, current;
+    previous.reset(words);
+    current.reset(words);
+    current.set(1);
+    current.set(bits * branches - 1);
+    char name[24];
+
+    snprintf(name, sizeof(name), "trigger_event_%s", suffix);
+    run(name, 200, [&](unsigned long i) { sink += input.triggerEvent(previous, current); });
+  }
+};
+
+volatile unsigned long Bench::sink = 0;
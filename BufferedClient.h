@@ -0,0 +1,138 @@
+#include <Client.h>
+
+/// Buffered Client between PubSubClient and the EthernetClient
+///
+/// Each publish is otherwise its own write to the W5x00 (SPI transaction and TCP segment), and each
+/// byte read is its own SPI transaction. Here the writes are gathered until the buffer is full, the
+/// end of the loop (flush()), or a small time bound ; the reads are done by chunks.
+/// Pending writes are also sent when there is nothing to read : a request waiting for its answer is never stuck.
+/// A write reports success once buffered : mqtt_publish() flushes after each publish and checks writeErrors,
+/// so that a lost publish is reported to its caller.
+class BufferedClient : public Client {
+  static const int WRITE_SIZE = 128;
+  static const int READ_SIZE = 32;
+  /// Time bound of a pending write
+  static const unsigned long FLUSH_MS = 5;
+
+  Client & _client;
+  byte _write[WRITE_SIZE];
+  int _writeLength;
+  unsigned long _writeMillis;
+  byte _read[READ_SIZE];
+  int _readPosition;
+  int _readLength;
+
+public:
+  /// Writes to the W5x00 (one per flush) : reset by the caller (metrics period)
+  unsigned int flushes;
+  /// Failed writes, since boot
+  unsigned int writeErrors;
+
+public:
+  BufferedClient(Client & client) : _client(client), _writeLength(0), _writeMillis(0), _readPosition(0), _readLength(0), flushes(0), writeErrors(0) {}
+
+  virtual int connect(IPAddress ip, uint16_t port) { reset(); return _client.connect(ip, port); }
+  virtual int connect(const char * host, uint16_t port) { reset(); return _client.connect(host, port); }
+
+  using Print::write;
+  virtual size_t write(uint8_t b) { return write(&b, 1); }
+  virtual size_t write(const uint8_t * buffer, size_t size)
+  {
+    if (_writeLength + size > WRITE_SIZE)
+      flush();
+    // nb: larger than the buffer, sent as is
+    if (size > WRITE_SIZE)
+      return send(buffer, size) ? size : 0;
+
+    if (_writeLength == 0)
+      _writeMillis = millis();
+    memcpy(_write + _writeLength, buffer, size);
+    _writeLength += size;
+    if (millis() - _writeMillis >= FLUSH_MS)
+      flush();
+    return size;
+  }
+
+  /// Send the pending writes
+  virtual void flush()
+  {
+    if (_writeLength == 0)
+      return;
+    send(_write, _writeLength);
+    _writeLength = 0;
+  }
+
+  /// Bytes to read
+  /// nb: side effect, the pending writes are sent when there is nothing to read (core_sync relies on it for its marker)
+  virtual int available()
+  {
+    int n = _readLength - _readPosition + _client.available();
+    // nb: while draining the incoming messages, their answers keep being gathered
+    if (n == 0)
+      flush();
+    return n;
+  }
+  virtual int read()
+  {
+    if (!fill())
+      return -1;
+    return _read[_readPosition++];
+  }
+  virtual int read(uint8_t * buffer, size_t size)
+  {
+    if (!fill())
+      return -1;
+    int n = min((int)size, _readLength - _readPosition);
+    memcpy(buffer, _read + _readPosition, n);
+    _readPosition += n;
+    return n;
+  }
+  virtual int peek()
+  {
+    if (!fill())
+      return -1;
+    return _read[_readPosition];
+  }
+
+  virtual void stop() { reset(); _client.stop(); }
+  virtual uint8_t connected() { return _readPosition < _readLength || _client.connected(); }
+  virtual operator bool() { return (bool)_client; }
+
+private:
+  void reset()
+  {
+    _writeLength = 0;
+    _readPosition = _readLength = 0;
+  }
+
+  /// @return false if the write failed : the connection is closed, PubSubClient will reconnect
+  bool send(const uint8_t * buffer, size_t size)
+  {
+    flushes++;
+    if (_client.write(buffer, size) == size)
+      return true;
+    writeErrors++;
+    _client.stop();
+    return false;
+  }
+
+  /// @return true if some data is buffered
+  bool fill()
+  {
+    if (_readPosition < _readLength)
+      return true;
+    _readPosition = 0;
+    _readLength = 0;
+    int available = _client.available();
+    if (available <= 0)
+    {
+      flush();
+      return false;
+    }
+    int n = _client.read(_read, min(available, READ_SIZE));
+    if (n <= 0)
+      return false;
+    _readLength = n;
+    return true;
+  }
+};
@@ -25,6 +25,8 @@ public:
     const char * topic_bt_up;
     /// MQTT topic for button DW input
     const char * topic_bt_dw;
+    /// Length of the cover topic prefix
+    byte topic_cover_len;
 
     /// Time in millis to completely go up (excluding lag)
     word time_up;
@@ -60,15 +62,20 @@ public:
     /// Currently set to dw
     bool status_dw;
 
+    /// End of move timer (NO_TIMER : none, or none available and the end is polled)
+    byte end_timer;
+    /// End of move timer fired
+    bool end_due;
+
 public:
   Cover();
   Cover(const char * cv, const char * up, const char * dw, const char * btup, const char * btdw, int tup, int tdw, int tlag, int tmargin);
   /// Common loop
   void Loop();
-  /// MQTT Callback 
-  void Callback(char* topic, byte* payload, unsigned int length);
+  /// MQTT Callback (commands false : only update our state, e.g. from retained messages)
+  void Callback(char* topic, byte* payload, unsigned int length, bool commands = true);
   /// Setup
-  static void Setup(bool (* fun)(const char*, const char*, bool));
+  static void Setup(bool (* fun)(const char*, const char*, bool), TimerWheel * wheel);
   
 private:
   // TRIGGER MOVEMENT 
@@ -85,14 +92,22 @@ private:
 private:
   // Helper function : stop the cover
   void StopMovement();
+  // Helper function : (re)arm the end of move timer
+  void ArmEndOfMove();
+  // Timer callback
+  static void OnEndOfMove(void * context);
 
 private:
   //  static publish function pointer
   static bool (* publish_generic)(const char * topic, const char * payload, bool retain);  
+  //  static timer wheel (end of move deadlines)
+  static TimerWheel * timers;
 };
 
 //  static publish function pointer
 bool (* Cover::publish_generic)(const char * topic, const char * payload, bool retain) = 0;
+//  static timer wheel
+TimerWheel * Cover::timers = 0;
 
 Cover::Cover()
 : actual_pos(NO_VALUE),
@@ -100,7 +115,9 @@ Cover::Cover()
   millis_delta_time_expected(0),
   setpoint_pos(NO_VALUE),
   memo_pos(NO_VALUE),
-  memo_setpoint_pos(NO_VALUE)
+  memo_setpoint_pos(NO_VALUE),
+  end_timer(TimerWheel::NO_TIMER),
+  end_due(false)
 {}
 Cover::Cover(const char * cv, const char * up, const char * dw, const char * btup, const char * btdw, int tup, int tdw, int tlag, int tmargin)
 : topic_cover(cv),
@@ -108,6 +125,7 @@ Cover::Cover(const char * cv, const char * up, const char * dw, const char * btu
   topic_dw(dw),
   topic_bt_up(btup),
   topic_bt_dw(btdw),
+  topic_cover_len(strlen(cv)),
   time_up(tup),
   time_dw(tdw),
   time_margin(tmargin),
@@ -117,7 +135,9 @@ Cover::Cover(const char * cv, const char * up, const char * dw, const char * btu
   millis_delta_time_expected(0),
   setpoint_pos(NO_VALUE),
   memo_pos(NO_VALUE),
-  memo_setpoint_pos(NO_VALUE)
+  memo_setpoint_pos(NO_VALUE),
+  end_timer(TimerWheel::NO_TIMER),
+  end_due(false)
 {
 }
 
@@ -133,16 +153,35 @@ void Cover::StopMovement()
   memo_setpoint_pos = NO_VALUE;
   millis_delta_time_expected = 0;
   millis_time_start = 0;
+  timers->cancel(end_timer);
+  end_timer = TimerWheel::NO_TIMER;
+  end_due = false;
   // ------------- ^^ END ^^  
 }
 
-void Cover::Callback(char* topic, byte* payload, unsigned int length)
+void Cover::ArmEndOfMove()
+{
+  timers->cancel(end_timer);
+  end_due = false;
+  // nb: fires when (now - start > expected), as tested by loop_testEndOfMovement()
+  end_timer = timers->arm(millis_time_start + millis_delta_time_expected + 1, &OnEndOfMove, this);
+}
+
+void Cover::OnEndOfMove(void * context)
+{
+  Cover * cover = (Cover *) context;
+  cover->end_timer = TimerWheel::NO_TIMER;
+  cover->end_due = true;
+}
+
+void Cover::Callback(char* topic, byte* payload, unsigned int length, bool commands)
 {
-  bool on = length == 1 && (char)payload[0] == '1';
-  bool off = length == 1 && (char)payload[0] == '0';
+  bool on = MqttParse::equals(payload, length, "1");
   
   // *** Test IN TOPIC => setpoint 0/100
-  if (!strcmp(topic, topic_bt_up) && on) {
+  if (!commands && (!strcmp(topic, topic_bt_up) || !strcmp(topic, topic_bt_dw))) {
+    // ignored
+  } else if (!strcmp(topic, topic_bt_up) && on) {
     // A good way to stop ?
     if (status_up)
       setpoint_pos = actual_pos;
@@ -167,25 +206,27 @@ void Cover::Callback(char* topic, byte* payload, unsigned int length)
   else 
   {
     // Specific cover
-    auto covername_len = strlen(topic_cover);
-    if (!strncmp(topic_cover, topic, covername_len))
+    const char * tail = MqttParse::suffix(topic, topic_cover, topic_cover_len);
+    if (tail != NULL)
     {
        Serial.print(topic_cover);Serial.println(" PREFIX command detected");
        Serial.println(topic);        
       
       // *** Test /set TOPIC => commands OPEN CLOSE STOP
-      if (!strcmp(topic + covername_len, "/set"))
+      if (!commands && strcmp(tail, "/pos"))
+        return;
+      if (!strcmp(tail, "/set"))
       {
         Serial.print(topic_cover);Serial.println(" SET command received");        
         Serial.println(topic);        
         
-        if (length == 4 && !memcmp((char*)payload,"OPEN",4)) {
+        if (MqttParse::equals(payload, length, "OPEN")) {
           Serial.println("Got OPEN"); 
           setpoint_pos = 100;
-        }else if (length == 5 && !memcmp((char*)payload,"CLOSE",5)) {
+        }else if (MqttParse::equals(payload, length, "CLOSE")) {
           Serial.println("Got CLOSE"); 
           setpoint_pos = 0;
-        }else if (length == 4 && !memcmp((char*)payload,"STOP",4)) {
+        }else if (MqttParse::equals(payload, length, "STOP")) {
           Serial.println("Got STOP"); 
           StopMovement();
         }else {
@@ -197,18 +238,18 @@ void Cover::Callback(char* topic, byte* payload, unsigned int length)
         return;
       }
  
-      int value_payload = length <= 5 ? atoi((char*)payload): -1;
-      if (value_payload < 0 || value_payload > 100)
+      int value_payload;
+      if (!MqttParse::toInt(payload, length, value_payload) || value_payload < 0 || value_payload > 100)
         return;
       
       // *** Test /pos/set TOPIC => setpoint value
-      if (!strcmp(topic + covername_len, "/pos/set"))
+      if (!strcmp(tail, "/pos/set"))
       {
         Serial.print(topic_cover);Serial.println(" SETPOINT value received");
         setpoint_pos = value_payload;
       }
       // *** Test /pos TOPIC => set initial pos
-      else if (!strcmp(topic + covername_len, "/pos"))
+      else if (!strcmp(tail, "/pos"))
       {
         if (actual_pos == NO_VALUE) {
           Serial.print(topic_cover);Serial.print(" POS value updated to ");Serial.println(value_payload);
@@ -221,9 +262,10 @@ void Cover::Callback(char* topic, byte* payload, unsigned int length)
 }
 
 /// Setup
-void Cover::Setup(bool (* fun)(const char*, const char*, bool))
+void Cover::Setup(bool (* fun)(const char*, const char*, bool), TimerWheel * wheel)
 {
   publish_generic = fun;
+  timers = wheel;
 }
 
 void Cover::Loop()
@@ -253,7 +295,10 @@ void Cover::loop_testTrigger()
 
     // Fail if current position is not known and set neither 0 nor 100
     if (actual_pos == NO_VALUE && memo_setpoint_pos != 0 && memo_setpoint_pos != 100)
+    {
+      ArmEndOfMove();
       return;
+    }
 
     //START
     millis_time_start = millis();
@@ -297,13 +342,17 @@ void Cover::loop_testTrigger()
     {
       Serial.print(topic_cover);Serial.print(" START MOVE FOR (ms) : ");Serial.println((int)millis_delta_time_expected);
     }
+    if (memo_setpoint_pos != NO_VALUE)
+      ArmEndOfMove();
   }
 }
 // 2) TEST END MOVEMENT
 void Cover::loop_testEndOfMovement()
 {
-  if (memo_setpoint_pos != NO_VALUE)
+  // Only when the timer fired (or could not be armed)
+  if (memo_setpoint_pos != NO_VALUE && (end_due || end_timer == TimerWheel::NO_TIMER))
   {
+    end_due = false;
     if (millis() - millis_time_start > millis_delta_time_expected)
     {
       Serial.print(topic_cover);Serial.println(" END OF MOVE DETECTED");
@@ -13,38 +13,100 @@ void printAddress(char * addressBuffer, size_t addressBufferSize, DeviceAddress
   }
 }
 
-#ifdef WITH_DUMP_LIST
-// fwd
-void dumpList(int deviceCount, DallasTemperature & sensors)
+/// Temperature in raw DS18 units (1/16 °C), from a constant in °C (folded at compile time : no float code)
+#define DS18_RAW(celsius) ((int16_t)((celsius) * 16))
+
+// Formats a raw temperature (1/16 °C) to string, e.g. "21.50", with integers only
+void printTemperature(char * buffer, size_t bufferSize, int16_t raw)
 {
-  DeviceAddress address;
-  for (int idx = (int)sensors.getDeviceCount() - 1; idx >= 0 ; idx--)
-    if (sensors.getAddress(address, idx))
-    {
-      Serial.print("Sensor found @");Serial.print(idx);Serial.print(" addr: ");
-      char buff[18];
-      printAddress(buff, sizeof(buff), address);
-      Serial.println(buff);
-    }
+  // hundredths, rounded half away from zero
+  long centi = ((long)raw * 100 + (raw < 0 ? -8 : 8)) / 16;
+  unsigned long a = centi < 0 ? -centi : centi;
+  snprintf(buffer, bufferSize, "%s%lu.%02lu", centi < 0 ? "-" : "", a / 100, a % 100);
 }
-#endif
 
 
-struct MemoOneWireDevice {
+/// Per-sensor settings, matched on the sensor address at discovery time
+struct DS18Settings {
+  /// Sensor address as printed by printAddress(), NULL for the default (last) row
+  const char * address;
+  /// Conversion resolution 9..12 bits (12 bits : 0.0625°C in ~750 ms, 9 bits : 0.5°C in ~94 ms)
+  byte resolution;
+  /// Margin between published changes in temperature, raw units (see DS18_RAW())
+  int16_t change_margin;
+  /// Sampling period when temperature is changing
+  unsigned long min_period_ms;
+  /// Sampling period when temperature is stable
+  unsigned long max_period_ms;
+};
+
+/// A known sensor : one slot of the registry
+struct DS18Sensor {
   DeviceAddress dev;
-  float temp;
-  bool changed;
-  int pinHint;
+  /// Last published temperature, raw DS18 units (1/16 °C), NO_TEMP until the first read
+  int16_t raw;
+  /// Bus (pin) the sensor was found on
+  byte pin;
+  bool changed : 1;
+  /// Conversion requested for this sensor, to be read in the current cycle
+  bool pending : 1;
+  /// Resolution written (PHASE_CONFIGURE)
+  bool configured : 1;
+  /// Settings row found for this sensor
+  const DS18Settings * settings;
+  /// Current (adaptive) sampling period
+  unsigned long period;
+  /// millis() of the last sample
+  unsigned long lastSampleMillis;
+
+  static const int16_t NO_TEMP = INT16_MIN;
 };
 
-#define KNOWN_DS1820 40
-MemoOneWireDevice ds1820[KNOWN_DS1820];
+/// Known sensors of all the buses, sized from the configuration
+///
+/// Slots are given in discovery order and never freed : slots [0, used) are the sensors, no empty
+/// marker to test. The buses refer to their sensors by slot index.
+class DS18Registry {
+public:
+  DS18Sensor * slots;
+  byte capacity;
+  byte used;
+
+  DS18Registry() : slots(0), capacity(0), used(0) {}
+
+  void allocate(byte n)
+  {
+    slots = new DS18Sensor[n];
+    capacity = n;
+    used = 0;
+  }
+
+  /// Slot of a sensor address, -1 if unknown
+  /// @param hint slot expected (a bus search always finds its sensors in the same order), checked first
+  int find(const DeviceAddress adr, int hint) const
+  {
+    if (hint >= 0 && hint < used && !memcmp(slots[hint].dev, adr, sizeof(DeviceAddress)))
+      return hint;
+    for (int i = 0; i < used; i++)
+      if (!memcmp(slots[i].dev, adr, sizeof(DeviceAddress)))
+        return i;
+    return -1;
+  }
+};
+
+DS18Registry ds18_registry;
 
 
 /// Lecture d'objets température sur bus 1-wire
+///
+/// Each call of loop() does at most one OneWire step : one ROM search step (one sensor found),
+/// one resolution write, one conversion request or one scratchpad read. A bus with dozens of sensors is therefore read
+/// over as many loops, and the caller bounds the time spent per loop (see ManyDS18X::loop()).
 class DS18X {
    enum Phase {
     PHASE_BEGIN,
+    PHASE_SEARCH,
+    PHASE_CONFIGURE,
     PHASE_REQUEST,
     PHASE_WAIT,
     PHASE_READ,
@@ -55,33 +117,274 @@ class DS18X {
    DallasTemperature _sensors;
    int _pin;
    int _count;
+   /// Sensors found by the current search
+   int _found;
+   /// Slot of the last sensor found by the current search (-1 : none yet)
+   int _foundSlot;
+   /// Next registry slot to read (PHASE_READ)
+   int _readIndex;
    long _lastReadMillis;
-   // millis for DS18x20 family is  ~750 ms depending on resolution
-   const long delayRead = 1000;
-   // millis between two reads
-   const long delaySleep = 60000;
-   
-   // margin between changes in temperature
-   const float changeMargin = 0.05f;
+   long _lastScanMillis;
+   // millis to wait for the current conversion (depends on the resolution of the requested sensors)
+   long _delayRead;
+   // millis before the next sensor is due
+   long _delaySleep;
+   // millis between two bus scans (new sensors detection)
+   const long delayRescan = 60000;
+   // extra millis for the conversion, on top of the datasheet values
+   const long conversionMargin = 5;
+   // scratchpad commands and registers (datasheet)
+   static const byte WRITE_SCRATCHPAD = 0x4E;
+   static const byte ALARM_HIGH = 2;
+   static const byte ALARM_LOW = 3;
+   static const byte CONFIGURATION = 4;
+   static const byte COUNT_REMAIN = 6;
+   // temperature register at power-on : 85 °C
+   static const int16_t POWER_ON_RAW = 0x0550;
+   // DS18S20 : fixed resolution, no configuration register
+   static const byte FAMILY_DS18S20 = 0x10;
 public:   
    /// Création du bus sur un pin donné
    DS18X(int busPin);
    /// Initialisation
    void setup();
-   /// Boucle commune
-   void loop();
-   /// Scan des appareils
-   
+   /// Boucle commune : one step, @return true if the bus was used
+   bool loop();
+   /// Settings table (NULL address terminated, the terminal row holds the defaults)
+   static const DS18Settings * settings_table;
+   /// Failed reads, all buses (metrics)
+   static unsigned int readErrors;
+   /// Longest OneWire step (micros), all buses, since boot (metrics)
+   static unsigned long stepMax;
+
+private:
+   /// Find the settings row of a sensor address
+   static const DS18Settings * findSettings(DeviceAddress adr);
+   /// Datasheet conversion time for a resolution: 750 ms at 12 bits, halved for each bit less
+   /// Configuration register for a resolution
+   static byte configurationOf(byte resolution) { return ((constrain(resolution, 9, 12) - 9) << 5) | 0x1F; }
+   /// Temperature of a scratchpad, raw units (1/16 °C)
+   static int16_t rawTemperature(const DeviceAddress adr, const ScratchPad scratch);
+   static long conversionMillis(byte resolution) { return 750L >> (12 - constrain(resolution, 9, 12)); }
+   /// Flag the sensors of our bus which are due, @return the conversion time needed (0 if none due)
+   long markDueSensors();
+   /// @return millis before the next sensor of our bus is due
+   long computeSleep();
+   /// Add a sensor found by the search to the registry (if new)
+   void discovered(DeviceAddress adr);
+   /// Next slot of our bus after a slot (-1 if none)
+   int nextSlot(int slot) const;
+   /// Read the next due sensor of our bus, @return false if none is left
+   bool readNext();
+   /// Write the resolution of the next new sensor of our bus, @return false if none is left
+   bool configureNext();
 };
+
+const DS18Settings * DS18X::settings_table = 0;
+unsigned int DS18X::readErrors = 0;
+unsigned long DS18X::stepMax = 0;
+
+const DS18Settings * DS18X::findSettings(DeviceAddress adr)
+{
+  char buff[18];
+  printAddress(buff, sizeof(buff), adr);
+  const DS18Settings * row = settings_table;
+  for (; row->address != NULL; row++)
+    if (!strcmp(row->address, buff))
+      break;
+  return row;
+}
+
+long DS18X::markDueSensors()
+{
+  long delayNeeded = 0;
+  unsigned long now = millis();
+  for (byte i = 0; i < ds18_registry.used; i++)
+  {
+    DS18Sensor & z = ds18_registry.slots[i];
+    if (z.pin != _pin)
+      continue;
+    // never read, or period elapsed
+    z.pending = z.raw == DS18Sensor::NO_TEMP || now - z.lastSampleMillis >= z.period;
+    if (z.pending)
+      delayNeeded = max(delayNeeded, conversionMillis(z.settings->resolution) + conversionMargin);
+  }
+  return delayNeeded;
+}
+
+long DS18X::computeSleep()
+{
+  long sleep = delayRescan;
+  unsigned long now = millis();
+  for (byte i = 0; i < ds18_registry.used; i++)
+  {
+    const DS18Sensor & z = ds18_registry.slots[i];
+    if (z.pin != _pin)
+      continue;
+    unsigned long elapsed = now - z.lastSampleMillis;
+    sleep = min(sleep, elapsed >= z.period ? 0L : (long)(z.period - elapsed));
+  }
+  return sleep;
+}
+int DS18X::nextSlot(int slot) const
+{
+  for (int i = slot + 1; i < ds18_registry.used; i++)
+    if (ds18_registry.slots[i].pin == _pin)
+      return i;
+  return -1;
+}
+
+void DS18X::discovered(DeviceAddress adr)
+{
+  // known : usually the slot after the previous one found on this bus
+  int slot = ds18_registry.find(adr, nextSlot(_foundSlot));
+  if (slot >= 0)
+  {
+    _foundSlot = slot;
+    return;
+  }
+  if (ds18_registry.used == ds18_registry.capacity)
+  {
+    Serial.print("DS18 registry full, pin "); Serial.println(_pin);
+    return;
+  }
+  _foundSlot = ds18_registry.used++;
+  DS18Sensor & z = ds18_registry.slots[_foundSlot];
+  memcpy(z.dev, adr, sizeof(DeviceAddress));
+  z.pin = _pin;
+  z.raw = DS18Sensor::NO_TEMP;
+  z.changed = false;
+  z.pending = false;
+  // nb: the resolution is written by its own step (PHASE_CONFIGURE)
+  z.configured = false;
+  z.settings = findSettings(adr);
+  z.period = z.settings->min_period_ms;
+  z.lastSampleMillis = millis();
+#ifdef WITH_DUMP_LIST
+  Serial.print("Sensor found on pin ");Serial.print(_pin);Serial.print(" addr: ");
+  char buff[18];
+  printAddress(buff, sizeof(buff), adr);
+  Serial.println(buff);
+#endif
+}
+
+int16_t DS18X::rawTemperature(const DeviceAddress adr, const ScratchPad scratch)
+{
+  int16_t raw = (scratch[1] << 8) | scratch[0];
+  // DS18S20 : 1/2 °C, extended with the count remain (16 counts per °C)
+  if (adr[0] == FAMILY_DS18S20)
+    return ((raw & ~1) << 3) - 4 + (16 - scratch[COUNT_REMAIN]);
+  // the bits below the resolution are undefined
+  byte bits = 9 + (scratch[CONFIGURATION] >> 5);
+  return raw & ~((1 << (12 - bits)) - 1);
+}
+
+bool DS18X::readNext()
+{
+  for (; _readIndex < ds18_registry.used; _readIndex++)
+  {
+    DS18Sensor & z = ds18_registry.slots[_readIndex];
+    // pas branché sur notre pin à nous, ou pas demandé
+    if (z.pin != _pin || !z.pending)
+      continue;
+    _readIndex++;
+
+    z.pending = false;
+    z.lastSampleMillis = millis();
+    // nb: one scratchpad read (CRC checked) for the temperature and the configuration
+    ScratchPad scratch;
+    if (!_sensors.isConnected(z.dev, scratch))
+    {
+      readErrors++;
+      return true;
+    }
+    // a sensor which lost its power is back to its EEPROM resolution (converting longer than waited for),
+    // and reads the power-on value : reading dropped, configured again before the next request
+    int16_t t = rawTemperature(z.dev, scratch);
+    if ((z.dev[0] != FAMILY_DS18S20 && scratch[CONFIGURATION] != configurationOf(z.settings->resolution))
+        || (t == POWER_ON_RAW && (z.raw == DS18Sensor::NO_TEMP || abs(z.raw - t) > DS18_RAW(1))))
+    {
+      z.configured = false;
+      readErrors++;
+      return true;
+    }
+    // écrire en cas de changement de température
+    if (z.raw == DS18Sensor::NO_TEMP || abs(t - z.raw) > z.settings->change_margin)
+    {
+      // changing : sample faster
+      z.period = max(z.settings->min_period_ms, z.period / 2);
+      z.raw = t;
+      z.changed = true;
+
+#ifdef WITH_DUMP_TEMP
+      Serial.print(" - pin ");
+      Serial.print(_pin);
+      Serial.print(" / ");
+      char buff[18];
+      printAddress(buff, sizeof(buff), z.dev);
+      Serial.print(buff);
+      Serial.print(" : ");
+      printTemperature(buff, sizeof(buff), t);
+      Serial.println(buff);
+#endif
+    }
+    else
+    {
+      // stable : back off
+      z.period = min(z.settings->max_period_ms, z.period + z.period / 2);
+    }
+    return true;
+  }
+  return false;
+}
+
+bool DS18X::configureNext()
+{
+  for (; _readIndex < ds18_registry.used; _readIndex++)
+  {
+    DS18Sensor & z = ds18_registry.slots[_readIndex];
+    if (z.pin != _pin || z.configured)
+      continue;
+    _readIndex++;
+
+    if (z.dev[0] == FAMILY_DS18S20)
+    {
+      z.configured = true;
+      return true;
+    }
+    // nb: scratchpad only, not copied to the sensor EEPROM (DallasTemperature::setResolution() : +20 ms blocking)
+    // the alarm registers are kept as they are
+    ScratchPad scratch;
+    if (!_sensors.readScratchPad(z.dev, scratch))
+    {
+      // retried before the next request
+      readErrors++;
+      return true;
+    }
+    _bus.reset();
+    _bus.select(z.dev);
+    _bus.write(WRITE_SCRATCHPAD);
+    _bus.write(scratch[ALARM_HIGH]);
+    _bus.write(scratch[ALARM_LOW]);
+    _bus.write(configurationOf(z.settings->resolution));
+    _bus.reset();
+    z.configured = true;
+    return true;
+  }
+  return false;
+}
+
 // Création
-DS18X::DS18X(int busPin) : _bus(busPin), _sensors(&_bus), _pin(busPin),_count(0),_phase(PHASE_BEGIN) {  
+DS18X::DS18X(int busPin) : _bus(busPin), _sensors(&_bus), _pin(busPin),_count(0),_found(0),_foundSlot(-1),_readIndex(0),_phase(PHASE_BEGIN),_lastScanMillis(0),_delayRead(0),_delaySleep(0) {  
 }
 void DS18X::setup() {
-  _sensors.setResolution(12);
+  // nb: the full search of begin() is only done here, at boot (parasite power detection) ; the rescans are done step by step
+  _sensors.begin();
+  // nb: the resolution is then set per sensor on discovery
   _sensors.setWaitForConversion(false);
   _sensors.setCheckForConversion(false);  
 }
-void DS18X::loop() {
+bool DS18X::loop() {
   #if 0
   Serial.print("-loop ");
   Serial.print(_pin);
@@ -92,123 +395,101 @@ void DS18X::loop() {
   switch (_phase)
   {
     case PHASE_BEGIN:
+      _bus.reset_search();
+      _found = 0;
+      _foundSlot = -1;
+      _phase = PHASE_SEARCH;
+      break;
+    case PHASE_SEARCH:
       {
-         _sensors.begin(); 
-         int cnt = _sensors.getDeviceCount();
-         if (_count != cnt)
+         // one sensor per step
+         DeviceAddress adr;
+         if (_bus.search(adr))
          {
-             for (int devId = 0; devId < cnt; devId++)
-             {
-                DeviceAddress adr;
-                if (_sensors.getAddress(adr, devId))
-                {
-                  bool found = false;
-                  // fill our memory list
-                  for(MemoOneWireDevice & z : ds1820)
-                  {
-                    if (!memcmp(z.dev, adr, sizeof(DeviceAddress))) {
-                      found = true;
-                      break;
-                    }
-                  }
-                  if (!found) {
-                    for(MemoOneWireDevice & z : ds1820)
-                    {
-                      // search for empty address
-                      if (z.dev[0] == 0 && z.dev[1] == 0)
-                      {
-                        memcpy(z.dev, adr, sizeof(DeviceAddress));
-                        z.pinHint = _pin;
-                        z.temp = DEVICE_DISCONNECTED_C;
-                        z.changed = false;
-                        break;
-                      }
-                    }
-                           
-                  }
-                }
-             }
-#ifdef WITH_DUMP_LIST
-             // dump ?
-             dumpList(cnt, _sensors);
-#endif
-             _count = cnt;
+           if (OneWire::crc8(adr, 7) == adr[7] && _sensors.validFamily(adr))
+           {
+             _found++;
+             discovered(adr);
+           }
+           return true;
+         }
+         if (_count != _found)
+         {
+           Serial.print("DS18 pin "); Serial.print(_pin); Serial.print(" sensors: "); Serial.println(_found);
+           _count = _found;
          }
-         _phase = PHASE_REQUEST;
+         _lastScanMillis = millis();
+         _readIndex = 0;
+         _phase = PHASE_CONFIGURE;
       }
+      return true;
+    case PHASE_CONFIGURE:
+      // one new sensor per step
+      if (configureNext())
+        return true;
+      _phase = PHASE_REQUEST;
       break;
     case PHASE_REQUEST:
+      _delayRead = markDueSensors();
+      if (_delayRead == 0)
+      {
+        // nothing due on this bus (yet)
+        _delaySleep = computeSleep();
+        _phase = PHASE_SLEEP;
+        _lastReadMillis = millis();
+        break;
+      }
       _sensors.requestTemperatures(); // Send the command to get temperature readings 
       _phase = PHASE_WAIT;
       _lastReadMillis = millis();
-      break;
+      return true;
     case PHASE_WAIT:
-      if( millis() - _lastReadMillis > delayRead)
+      if( millis() - _lastReadMillis > _delayRead)
       {
+        _readIndex = 0;
         _phase = PHASE_READ;
       }
       break;
     case PHASE_READ:
-
-      for(MemoOneWireDevice & z : ds1820)
-      {
-        // pas initialisé
-        if (z.dev[0] == 0 && z.dev[1] == 0)
-          continue;
-        
-        // pas branché sur notre pin à nous
-        if (z.pinHint != 0 && z.pinHint != _pin)
-          continue;
-        float t = _sensors.getTempC(z.dev);
-        if (t == DEVICE_DISCONNECTED_C)
-          continue;
-        // écrire en cas de changement de température
-        if (z.temp == DEVICE_DISCONNECTED_C || fabs(z.temp - t) > changeMargin )
-        {
-          z.pinHint = _pin;
-          z.temp = t;
-          z.changed = true;
-          
-#ifdef WITH_DUMP_TEMP
-        Serial.print(" - pin ");
-        Serial.print(_pin);
-        Serial.print(" / ");
-        char buff[18];
-        printAddress(buff, sizeof(buff), z.dev);
-        
-        Serial.print(buff);
-        
-        Serial.print(" : ");
-        Serial.println(t);
-#endif
-          
-        }
-      }
+      // one sensor per step
+      if (readNext())
+        return true;
     
+      _delaySleep = computeSleep();
       _phase = PHASE_SLEEP;
       _lastReadMillis = millis();
       break;
    case PHASE_SLEEP:
-      if( millis() - _lastReadMillis > delaySleep)
+      if( millis() - _lastReadMillis >= _delaySleep)
       {
-        _phase = PHASE_BEGIN;
+        // rescan the bus from time to time, otherwise only sample the due sensors (configured again if needed)
+        _readIndex = 0;
+        _phase = millis() - _lastScanMillis > delayRescan ? PHASE_BEGIN : PHASE_CONFIGURE;
       }
       break;
   }
+  return false;
 }
 
 /// Handle many DS18x sensors
 class ManyDS18X {
+  /// OneWire time per loop : once spent, the other buses wait for the next loop
+  /// nb: a single step (~6 ms for a scratchpad read, ~13 ms for a search step) is never cut
+  static const unsigned long LOOP_BUDGET_US = 2000;
+
   DS18X ** _ds18;
   int _count;
+  /// First bus served in the next loop (round robin : no bus starves the others)
+  int _next;
   const char * _common_topic;
 public:
+  /// OneWire pins, and sensors known at most (all buses)
   template<size_t N>
-  ManyDS18X(const int (&pins)[N]);
+  ManyDS18X(const int (&pins)[N], byte capacity);
   
   void loop();
-  /// Pass MQTT common prefix TOPIC and MQTT callback function during setup()
-  void setup(const char * common_topic, bool (* fun)(const char*, const char*, bool));
+  /// Pass MQTT common prefix TOPIC, MQTT callback function and sensor settings table during setup()
+  void setup(const char * common_topic, bool (* fun)(const char*, const char*, bool), const DS18Settings * settings);
   
 private:
   void update_ds1820_variations();
@@ -218,9 +499,11 @@ private:
   
 };
 
-template<size_t N> ManyDS18X::ManyDS18X(const int (&pins)[N])
+template<size_t N> ManyDS18X::ManyDS18X(const int (&pins)[N], byte capacity)
 {
+  ds18_registry.allocate(capacity);
   _count = N;
+  _next = 0;
   _ds18 = new DS18X*[N];
 
   for(int q = 0; q < N; q++)
@@ -230,30 +513,31 @@ template<size_t N> ManyDS18X::ManyDS18X(const int (&pins)[N])
 }
 void ManyDS18X::loop()
 {
+  unsigned long start = micros();
   for(int q = 0; q < _count; q++)
   {
-     _ds18[q]->loop();
+     DS18X * bus = _ds18[_next];
+     _next = (_next + 1) % _count;
+     unsigned long stepStart = micros();
+     if (!bus->loop())
+       continue;
+     DS18X::stepMax = max(DS18X::stepMax, micros() - stepStart);
+     if (micros() - start >= LOOP_BUDGET_US)
+       break;
   }
   update_ds1820_variations();
 }
 
 /// @param common_topic MQTT topic prefix e.g. "HOME/SENSORS/TEMP/" sensor unique ID will be postfixed
-void ManyDS18X::setup(const char * common_topic, bool (* publish_generic_function)(const char*, const char*, bool))
+/// @param settings per sensor settings, NULL address terminated (the terminal row holds the defaults)
+void ManyDS18X::setup(const char * common_topic, bool (* publish_generic_function)(const char*, const char*, bool), const DS18Settings * settings)
 {
   // MQTT Prefix (HERE BE DRAGONS: NOT OWNED BY US !)
   _common_topic = common_topic;
   // MQTT Callback
   publish_generic = publish_generic_function;
-  
-  // Initialize memory !
-  for(MemoOneWireDevice & z : ds1820)
-  {
-    z.dev[0] = 0;
-    z.dev[1] = 0;
-    z.pinHint = 0;
-    z.temp = DEVICE_DISCONNECTED_C;
-    z.changed = false;
-  }
+  // Settings (not owned either)
+  DS18X::settings_table = settings;
   
   for(int q = 0; q < _count; q++)
   {
@@ -267,7 +551,8 @@ bool (* ManyDS18X::publish_generic)(const char * topic, const char * payload, bo
 
 
 void ManyDS18X::update_ds1820_variations() {
-  for (MemoOneWireDevice & device : ds1820) {
+  for (byte i = 0; i < ds18_registry.used; i++) {
+    DS18Sensor & device = ds18_registry.slots[i];
     if (device.changed) {
       device.changed = false;
 
@@ -277,14 +562,14 @@ void ManyDS18X::update_ds1820_variations() {
       char topicbuff[128];
       snprintf(topicbuff,sizeof(topicbuff),"%s%s", _common_topic, xxbuff);
       char tempbuff[12];
-      dtostrf(device.temp, 4, 2, tempbuff);
+      printTemperature(tempbuff, sizeof(tempbuff), device.raw);
       publish_generic(topicbuff, tempbuff, false);
       
       #if 1
       Serial.print("Sensor : ");
       Serial.print(xxbuff);
       Serial.print(" Temperature updated : ");
-      Serial.println(device.temp);      
+      Serial.println(tempbuff);
       #endif
     }
   }
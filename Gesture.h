@@ -0,0 +1,179 @@
+enum GestureKind {
+  Gesture_none,
+  /// Short press and release (delayed by the double click window if the input also has a double click)
+  Gesture_click,
+  /// Two short presses within the double click window
+  Gesture_double_click,
+  /// Held longer than the long press delay (fired once, while still held)
+  Gesture_long_press,
+  /// Held longer than the long press delay, then fired again every repeat delay until release (dimming)
+  Gesture_hold_repeat
+};
+
+
+/// Press pattern detection on an input, publishing an action when its gesture is recognized
+struct Gesture
+{
+public:
+    /// MQTT topic for the input button
+    const char * topic_input;
+    /// Gesture to recognize
+    GestureKind gesture;
+    /// MQTT action topic
+    const char * topic_action;
+    /// MQTT action payload
+    const char * payload_action;
+    /// Action published retained (a state, as publish_output) ; not for the relative actions ("+" of a dimming)
+    bool retain_action;
+
+    /// Long press delay in millis
+    word time_long;
+    /// Double click window in millis
+    word time_double;
+    /// Repeat delay in millis for the hold repeat
+    word time_repeat;
+
+private:
+    /// Another row of the same input waits for a double click
+    bool wait_double;
+    /// Currently pressed
+    bool pressed;
+    /// Long press already fired for the current press
+    bool fired_long;
+    /// Short clicks counted in the double click window
+    byte clicks;
+    /// press time, or last repeat time when held
+    unsigned long millis_press;
+    /// release time
+    unsigned long millis_release;
+
+public:
+  Gesture();
+  Gesture(const char * input, GestureKind kind, const char * action, const char * payload, int tlong = 800, int tdouble = 350, int trepeat = 300, bool retain = true);
+  /// Common loop
+  void Loop();
+  /// MQTT Callback
+  void Callback(char* topic, byte* payload, unsigned int length);
+  /// Setup with the NULL input terminated table
+  static void Setup(bool (* fun)(const char*, const char*, bool), Gesture * table);
+
+private:
+  // Publish our action if the gesture is ours
+  void Fire(GestureKind kind);
+
+private:
+  //  static publish function pointer
+  static bool (* publish_generic)(const char * topic, const char * payload, bool retain);
+};
+
+//  static publish function pointer
+bool (* Gesture::publish_generic)(const char * topic, const char * payload, bool retain) = 0;
+
+Gesture::Gesture()
+: topic_input(NULL),
+  gesture(Gesture_none)
+{}
+Gesture::Gesture(const char * input, GestureKind kind, const char * action, const char * payload, int tlong, int tdouble, int trepeat, bool retain)
+: topic_input(input),
+  gesture(kind),
+  topic_action(action),
+  payload_action(payload),
+  retain_action(retain),
+  time_long(tlong),
+  time_double(tdouble),
+  time_repeat(trepeat),
+  wait_double(false),
+  pressed(false),
+  fired_long(false),
+  clicks(0),
+  millis_press(0),
+  millis_release(0)
+{
+}
+
+/// Setup
+void Gesture::Setup(bool (* fun)(const char*, const char*, bool), Gesture * table)
+{
+  publish_generic = fun;
+
+  // A click is only known once the double click window is over, if the same input has a double click
+  for (Gesture * g = table; g->topic_input != NULL; g++)
+    for (Gesture * other = table; other->topic_input != NULL; other++)
+      if (other->gesture == Gesture_double_click && !strcmp(g->topic_input, other->topic_input))
+        g->wait_double = true;
+}
+
+void Gesture::Fire(GestureKind kind)
+{
+  if (kind != gesture)
+    return;
+  Serial.print(topic_input);Serial.print(" gesture ");Serial.print((int)kind);Serial.print(" => ");Serial.println(topic_action);
+  publish_generic(topic_action, payload_action, retain_action);
+}
+
+void Gesture::Callback(char* topic, byte* payload, unsigned int length)
+{
+  if (strcmp(topic, topic_input))
+    return;
+  bool on = MqttParse::equals(payload, length, "1");
+  unsigned long now = millis();
+
+  if (on && !pressed)
+  {
+    pressed = true;
+    fired_long = false;
+    millis_press = now;
+  }
+  else if (!on && pressed)
+  {
+    pressed = false;
+    if (fired_long)
+      return;
+
+    // short press
+    clicks++;
+    millis_release = now;
+    if (clicks >= 2)
+    {
+      clicks = 0;
+      Fire(Gesture_double_click);
+    }
+    else if (!wait_double)
+    {
+      clicks = 0;
+      Fire(Gesture_click);
+    }
+  }
+}
+
+void Gesture::Loop()
+{
+  // nothing in progress
+  if (!pressed && clicks == 0)
+    return;
+
+  unsigned long now = millis();
+  if (pressed)
+  {
+    // nb: the delta (now - start > delay) handles correctly the millis() rollover
+    if (!fired_long && now - millis_press >= time_long)
+    {
+      fired_long = true;
+      clicks = 0;
+      millis_press = now;
+      Fire(Gesture_long_press);
+      Fire(Gesture_hold_repeat);
+    }
+    else if (fired_long && now - millis_press >= time_repeat)
+    {
+      millis_press = now;
+      Fire(Gesture_hold_repeat);
+    }
+  }
+  else if (now - millis_release >= time_double)
+  {
+    // double click window over : it was a single click
+    clicks = 0;
+    Fire(Gesture_click);
+  }
+}
@@ -0,0 +1,114 @@
+/// Core view of the input modules, kept up to date by the input events and reconciled with the
+/// periodic snapshots of the input nodes (anti-entropy).
+///
+/// Snapshot : ROOT/IN/<module>/state = "<sequence> <bits>" (hexadecimal, bit n is ROOT/IN/<module>/n)
+/// The first snapshot of a module is the reference. After that, each bit differing from our view is a
+/// lost event : it is replayed as the event the input node published, e.g. ROOT/IN/2/5 = "1".
+class InputState {
+  /// Fixed limit (modules are added when their first snapshot is received)
+  static const byte MAX_MODULES = 8;
+
+  struct Module {
+    byte number;
+    /// last snapshot sequence
+    word sequence;
+    /// current view of the 32 inputs
+    unsigned long bits;
+  };
+
+  /// Input topics prefix, e.g. "MDB/IN/"
+  const char * _prefix;
+  byte _prefixLength;
+  Module _modules[MAX_MODULES];
+  byte _count;
+
+public:
+  /// Inputs fixed from a snapshot, since boot
+  unsigned int fixes;
+
+public:
+  InputState(const char * prefix) : _prefix(prefix), _prefixLength(strlen(prefix)), _count(0), fixes(0) {}
+
+  /// MQTT Callback : follow the input events, reconcile on snapshots
+  /// @param replay callback for the lost events
+  /// @return true if the message was a snapshot (consumed)
+  bool Callback(const char * topic, const byte * payload, unsigned int length, void (* replay)(char*, byte*, unsigned int))
+  {
+    const char * tail = MqttParse::suffix(topic, _prefix, _prefixLength);
+    if (tail == NULL)
+      return false;
+    const char * slash = strchr(tail, '/');
+    int number;
+    if (slash == NULL || !MqttParse::toInt((const byte *)tail, slash - tail, number))
+      return false;
+
+    if (!strcmp(slash, "/state"))
+    {
+      Snapshot(number, payload, length, replay);
+      return true;
+    }
+
+    // Event : ROOT/IN/<module>/<n> = 0/1
+    int n;
+    Module * module = Find(number);
+    if (module != NULL && MqttParse::toInt(slash + 1, n) && n >= 0 && n < 32 && length == 1)
+    {
+      if (payload[0] == '1')
+        module->bits |= 1UL << n;
+      else if (payload[0] == '0')
+        module->bits &= ~(1UL << n);
+    }
+    return false;
+  }
+
+private:
+  Module * Find(int number)
+  {
+    for (byte i = 0; i < _count; i++)
+      if (_modules[i].number == number)
+        return &_modules[i];
+    return NULL;
+  }
+
+  void Snapshot(int number, const byte * payload, unsigned int length, void (* replay)(char*, byte*, unsigned int))
+  {
+    const byte * space = (const byte *)memchr(payload, ' ', length);
+    unsigned long sequence, bits;
+    if (space == NULL
+        || !MqttParse::toHex(payload, space - payload, sequence)
+        || !MqttParse::toHex(space + 1, length - (space + 1 - payload), bits))
+      return;
+
+    Module * module = Find(number);
+    if (module == NULL)
+    {
+      // First snapshot : the reference
+      if (_count == MAX_MODULES)
+        return;
+      module = &_modules[_count++];
+      module->number = number;
+      module->sequence = sequence;
+      module->bits = bits;
+      return;
+    }
+
+    // nb: only newer snapshots, or the first one of a restarted node
+    if ((int16_t)((word)sequence - module->sequence) <= 0 && sequence != 1)
+      return;
+    module->sequence = sequence;
+
+    unsigned long changed = module->bits ^ bits;
+    module->bits = bits;
+    for (byte b = 0; changed != 0; b++, changed >>= 1)
+    {
+      if (!(changed & 1))
+        continue;
+      char topic[24];
+      snprintf(topic, sizeof(topic), "%s%d/%d", _prefix, number, b);
+      byte value = (bits >> b) & 1 ? '1' : '0';
+      Serial.print("Input fixed from snapshot : "); Serial.print(topic); Serial.print(" = "); Serial.println((char)value);
+      fixes++;
+      replay(topic, &value, 1);
+    }
+  }
+};
@@ -0,0 +1,55 @@
+/// Memory high water marks
+///
+/// The free RAM between the heap and the stack is painted with a pattern before main(). The deepest
+/// stack ever used is where the pattern stops, when scanning up from the top of the heap.
+class MemoryWatch {
+public:
+  static const byte PAINT = 0xA5;
+
+private:
+  /// Highest heap top seen
+  static unsigned int _heapTop;
+  /// Deepest stack address seen
+  static unsigned int _stackBottom;
+
+public:
+  /// Update the marks : scan the painted area (~1 us per free byte)
+  static void scan()
+  {
+    extern int __heap_start, *__brkval;
+    unsigned int heapTop = __brkval == 0 ? (unsigned int) &__heap_start : (unsigned int) __brkval;
+    _heapTop = max(_heapTop, heapTop);
+
+    const byte * p = (const byte *) heapTop;
+    const byte * sp = (const byte *) &p;
+    while (p < sp && *p == PAINT)
+      p++;
+    _stackBottom = min(_stackBottom, (unsigned int) p);
+  }
+
+  /// Heap bytes used, at most
+  static int heapMax()
+  {
+    extern int __heap_start;
+    return (int) (_heapTop - (unsigned int) &__heap_start);
+  }
+  /// Stack bytes used, at most
+  static int stackMax() { return (int) (RAMEND - _stackBottom + 1); }
+  /// Free RAM between heap and stack, at least (since boot)
+  static int minFree() { return (int) _stackBottom - (int) _heapTop; }
+};
+
+unsigned int MemoryWatch::_heapTop = 0;
+unsigned int MemoryWatch::_stackBottom = RAMEND;
+
+#ifdef __AVR__
+// Paint the RAM above the static data before main() and the constructors : untouched bytes keep the pattern
+void memory_watch_paint(void) __attribute__((naked, used, section(".init3")));
+void memory_watch_paint(void)
+{
+  extern byte _end;
+  byte * p = &_end;
+  while (p <= (byte *) SP)
+    *p++ = MemoryWatch::PAINT;
+}
+#endif
@@ -0,0 +1,102 @@
+/// Parsing helpers working in place on MQTT topics and (non terminated) payloads
+class MqttParse {
+public:
+  /// Bounded integer parse of a non terminated buffer : optional '-' then 1 to 5 digits, nothing else
+  /// @return false if the buffer is not such a number (value left untouched)
+  static bool toInt(const byte * buffer, unsigned int length, int & value)
+  {
+    unsigned int i = 0;
+    bool negative = length > 0 && buffer[0] == '-';
+    if (negative)
+      i++;
+    if (length <= i || length - i > 5)
+      return false;
+
+    long v = 0;
+    for (; i < length; i++)
+    {
+      if (buffer[i] < '0' || buffer[i] > '9')
+        return false;
+      v = v * 10 + (buffer[i] - '0');
+    }
+    if (v > 32767)
+      return false;
+    value = negative ? -v : v;
+    return true;
+  }
+
+  /// Bounded fixed point parse in hundredths of a non terminated buffer : "-12.34" => -1234, "1" => 100
+  /// extra decimals are truncated, @return false if the buffer is not such a number (value left untouched)
+  static bool toCenti(const byte * buffer, unsigned int length, int & value)
+  {
+    unsigned int i = 0;
+    bool negative = length > 0 && buffer[0] == '-';
+    if (negative)
+      i++;
+
+    long v = 0;
+    int digits = 0, decimals = -1;
+    for (; i < length; i++)
+    {
+      if (buffer[i] == '.' && decimals < 0)
+        decimals = 0;
+      else if (buffer[i] < '0' || buffer[i] > '9' || digits > 5)
+        return false;
+      else if (decimals < 2)
+      {
+        v = v * 10 + (buffer[i] - '0');
+        digits++;
+        if (decimals >= 0)
+          decimals++;
+      }
+    }
+    if (digits == 0)
+      return false;
+    for (decimals = max(decimals, 0); decimals < 2; decimals++)
+      v *= 10;
+    if (v > 32767)
+      return false;
+    value = negative ? -v : v;
+    return true;
+  }
+
+  /// Bounded hexadecimal parse of a non terminated buffer : 1 to 8 hex digits, nothing else
+  /// @return false if the buffer is not such a number (value left untouched)
+  static bool toHex(const byte * buffer, unsigned int length, unsigned long & value)
+  {
+    if (length == 0 || length > 8)
+      return false;
+    unsigned long v = 0;
+    for (unsigned int i = 0; i < length; i++)
+    {
+      byte c = buffer[i] | 0x20; // lower case
+      if (c >= '0' && c <= '9')
+        v = v << 4 | (c - '0');
+      else if (c >= 'a' && c <= 'f')
+        v = v << 4 | (c - 'a' + 10);
+      else
+        return false;
+    }
+    value = v;
+    return true;
+  }
+
+  /// Same on a terminated string, e.g. a topic tail
+  static bool toInt(const char * text, int & value)
+  {
+    return toInt((const byte *)text, strlen(text), value);
+  }
+
+  /// Keyword match of a non terminated buffer, e.g. "OPEN"
+  static bool equals(const byte * buffer, unsigned int length, const char * keyword)
+  {
+    return length == strlen(keyword) && !memcmp(buffer, keyword, length);
+  }
+
+  /// Prefix match of a topic against a precomputed prefix
+  /// @return the topic tail after the prefix, NULL if the topic does not start with the prefix
+  static const char * suffix(const char * topic, const char * prefix, size_t prefixLength)
+  {
+    return strncmp(topic, prefix, prefixLength) ? NULL : topic + prefixLength;
+  }
+};
@@ -0,0 +1,90 @@
+#include <EEPROM.h>
+
+/// Last applied outputs kept in EEPROM, restored at boot before the network is up
+///
+/// Wear levelling : the state is written in a ring of slots, each write to the next slot with an
+/// incremented sequence number. At boot the valid slot with the latest sequence wins (a slot broken
+/// by a brown-out fails its checksum, and the previous one is used).
+/// Write coalescing : a new state is only written once stable for a while.
+class OutputSnapshot {
+  struct Slot {
+    word sequence;
+    unsigned long data;
+    byte checksum;
+  };
+  /// Number of slots in the ring (each EEPROM cell is written SLOTS times less often)
+  static const int SLOTS = 64;
+  /// A state must be stable for this delay before being written
+  const unsigned long coalesceDelay = 5000;
+
+  /// EEPROM address of the ring
+  int _base;
+  /// Last slot written, and its sequence
+  int _slot;
+  word _sequence;
+  /// State in EEPROM
+  unsigned long _written;
+  /// State waiting to be written
+  unsigned long _pending;
+  unsigned long _pendingMillis;
+
+public:
+  /// Ring at a given EEPROM address (SLOTS * sizeof(Slot) bytes)
+  OutputSnapshot(int base) : _base(base), _slot(SLOTS - 1), _sequence(0), _written(0), _pending(0), _pendingMillis(0) {}
+
+  /// Find the latest valid slot, @return the state stored (0 if none)
+  unsigned long load()
+  {
+    bool found = false;
+    for (int i = 0; i < SLOTS; i++)
+    {
+      Slot s;
+      EEPROM.get(_base + i * sizeof(Slot), s);
+      if (s.checksum != checksum(s))
+        continue;
+      // nb: the difference handles the rollover of the sequence
+      if (!found || (int16_t)(s.sequence - _sequence) > 0)
+      {
+        found = true;
+        _slot = i;
+        _sequence = s.sequence;
+        _written = s.data;
+      }
+    }
+    _pending = _written;
+    Serial.print("Snapshot: "); Serial.print(found ? "restored slot " : "none, "); Serial.println(found ? _slot : 0);
+    return _written;
+  }
+
+  /// A new state was applied : write it later, once stable
+  void request(unsigned long data)
+  {
+    _pending = data;
+    _pendingMillis = millis();
+  }
+
+  /// Common loop : write the pending state when stable
+  void loop()
+  {
+    if (_pending == _written || millis() - _pendingMillis < coalesceDelay)
+      return;
+
+    Slot s;
+    s.sequence = ++_sequence;
+    s.data = _pending;
+    s.checksum = checksum(s);
+    _slot = (_slot + 1) % SLOTS;
+    EEPROM.put(_base + _slot * sizeof(Slot), s);
+    _written = _pending;
+  }
+
+private:
+  static byte checksum(const Slot & s)
+  {
+    const byte * p = (const byte *)&s;
+    byte sum = 0xA5;
+    for (size_t i = 0; i < offsetof(Slot, checksum); i++)
+      sum = (sum << 1 | sum >> 7) ^ p[i];
+    return sum;
+  }
+};
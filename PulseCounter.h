@@ -0,0 +1,79 @@
+/// Pulse counting on an input bit (S0 outputs of energy and water meters)
+///
+/// The counted bits are kept out of the debounced events : they are sampled by the Timer2 interrupt
+/// (PulseSampler.h), each sample is filtered (a level must be stable for filter_ms) and the rising
+/// edges are accumulated in RAM. Totals and rates are published at a fixed interval instead of one
+/// message per pulse.
+///
+/// No pulse is missed as long as the time between two samples plus the filter stays below the pulse
+/// width of the meter : at most PulseSampler::SAMPLE_MS plus one chain read, whatever the main loop
+/// does. Longer gaps are accounted by the missed pulses estimator : the pulses expected in the
+/// uncovered time, at the current pulse rate.
+///
+/// nb: updated by the interrupt, read with the interrupts disabled
+class PulseCounter {
+public:
+  /// Flat input index, -1 for the END of a table
+  int input;
+  /// Level stability needed (ms) : filters the contact bounces
+  unsigned int filter_ms;
+  /// Pulse width of the meter (ms), e.g. 30 ms for S0
+  unsigned int pulse_ms;
+
+  /// Pulses counted since boot
+  unsigned long total;
+  /// Pulses counted since the last publish
+  unsigned long period;
+  /// Missed pulses estimation, since boot (thousandths)
+  unsigned long missed_milli;
+
+private:
+  /// Filtered level, and raw level being confirmed with the millis() it was first seen
+  bool _level;
+  bool _raw;
+  unsigned long _rawMillis;
+  /// Last counted pulse, interval between the last two (0 : unknown yet)
+  unsigned long _pulseMillis;
+  unsigned long _interval;
+
+public:
+  PulseCounter(int input = -1, unsigned int filter_ms = 5, unsigned int pulse_ms = 30)
+  : input(input), filter_ms(filter_ms), pulse_ms(pulse_ms), total(0), period(0), missed_milli(0),
+    _level(false), _raw(false), _rawMillis(0), _pulseMillis(0), _interval(0) {}
+
+  /// Every sample (interrupt) : raw level of the input, time since the previous sample
+  void Scan(bool raw, unsigned long gap)
+  {
+    unsigned long now = millis();
+    // a whole pulse could fit in this gap : count the expected ones (current rate, slower if no pulse since)
+    if (gap + filter_ms > pulse_ms && _interval != 0)
+      missed_milli += (gap + filter_ms - pulse_ms) * 1000UL / max(_interval, now - gap - _pulseMillis);
+
+    if (raw != _raw)
+    {
+      _raw = raw;
+      _rawMillis = now;
+    }
+    if (_raw != _level && now - _rawMillis >= filter_ms)
+    {
+      _level = _raw;
+      // rising edge : one pulse
+      if (_level)
+      {
+        total++;
+        period++;
+        if (_pulseMillis != 0)
+          _interval = now - _pulseMillis;
+        _pulseMillis = now;
+      }
+    }
+  }
+
+  /// Pulses per hour over a period, and restart the period
+  unsigned long Rate(unsigned long elapsed_ms)
+  {
+    unsigned long rate = elapsed_ms < 1000 ? 0 : period * 3600UL / (elapsed_ms / 1000);
+    period = 0;
+    return rate;
+  }
+};
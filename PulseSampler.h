@@ -0,0 +1,172 @@
+/// Sampling of the counted input bits from the Timer2 compare interrupt (see PulseCounter.h)
+///
+/// Every SAMPLE_MS, the interrupt loads the 74HC165 chains and clocks them up to the deepest counted
+/// bit with a register-level reader (no digitalWrite, no digitalRead), then feeds each PulseCounter.
+/// The counting no longer depends on the main loop : a blocking reconnect or publish delays the
+/// events, not the samples.
+///
+/// The main loop reads the same chains : ShiftInput holds the interrupt during each of its reads
+/// (hold()), a sample due meanwhile runs right after. The longest gap between two samples is thus
+/// SAMPLE_MS plus one chain read (about 1 ms for 3 x 32 bits, 2 ms for 128 bits).
+class PulseSampler {
+public:
+  /// Sample period (ms) : Timer2, CTC, prescaler 256
+  static const byte SAMPLE_MS = 2;
+  /// Counters sampled at most
+  static const byte MAX_COUNTERS = 8;
+
+private:
+  volatile uint8_t * _plPort;
+  volatile uint8_t * _cePort;
+  volatile uint8_t * _clockPort;
+  uint8_t _plMask;
+  uint8_t _ceMask;
+  uint8_t _clockMask;
+  /// Data pins of the branches
+  volatile uint8_t * _dataPin[SHIFT_INPUT_MAX_BRANCHES];
+  uint8_t _dataMask[SHIFT_INPUT_MAX_BRANCHES];
+
+  /// Counters sampled, the clock step and the branch of their bit
+  PulseCounter * _counters[MAX_COUNTERS];
+  byte _step[MAX_COUNTERS];
+  byte _branch[MAX_COUNTERS];
+  byte _count;
+  /// Clock steps to the deepest counted bit
+  byte _steps;
+  /// Last sample
+  unsigned long _sampleMillis;
+
+public:
+  /// Longest interrupt (us), since the last metrics
+  volatile word isrMax;
+
+  /// The one driven by the interrupt
+  static PulseSampler * instance;
+
+public:
+  /// Same pins as ShiftInput
+  template<size_t N> PulseSampler(int ploadPin, int clockEnablePin, int clockPin, const int (&dataPins)[N])
+  : _plPort(portOutputRegister(digitalPinToPort(ploadPin))),
+    _cePort(portOutputRegister(digitalPinToPort(clockEnablePin))),
+    _clockPort(portOutputRegister(digitalPinToPort(clockPin))),
+    _plMask(digitalPinToBitMask(ploadPin)),
+    _ceMask(digitalPinToBitMask(clockEnablePin)),
+    _clockMask(digitalPinToBitMask(clockPin)),
+    _count(0),
+    _steps(0),
+    _sampleMillis(0),
+    isrMax(0)
+  {
+    static_assert(N <= SHIFT_INPUT_MAX_BRANCHES, "Too many branches");
+    for (byte j = 0; j < N; j++)
+    {
+      _dataPin[j] = portInputRegister(digitalPinToPort(dataPins[j]));
+      _dataMask[j] = digitalPinToBitMask(dataPins[j]);
+    }
+  }
+
+  /// Running (at least one counter in the topology)
+  bool running() const { return _count != 0; }
+
+  /// Start the interrupt for the counters of the END terminated table, after ShiftInput::setup()
+  /// @param bits bits read on each branch, outs total bits read, as ShiftInput
+  void setup(PulseCounter * table, byte bits, byte outs)
+  {
+    _count = 0;
+    _steps = 0;
+    for (PulseCounter * c = table; c->input >= 0 && _count < MAX_COUNTERS; c++)
+    {
+      if (c->input >= outs)
+        continue;
+      // position in the chains : as ShiftInput::readInputsInner() numbers the bits
+      int position = c->input;
+#ifdef HACK_FIX_LAST_TWO_BITS // Hardware V2.1
+      position = (position & ~3) | ((position ^ 3) & 3);
+#endif
+      _counters[_count] = c;
+      _step[_count] = position % bits;
+      _branch[_count] = position / bits;
+      _steps = max(_steps, (byte)(_step[_count] + 1));
+      _count++;
+    }
+    if (_count == 0)
+      return;
+    Serial.print("Pulses: "); Serial.print(_count); Serial.print(" counters, "); Serial.print(_steps); Serial.print(" bits sampled every ");
+    Serial.print(SAMPLE_MS); Serial.println(" ms");
+
+    instance = this;
+    _sampleMillis = millis();
+    noInterrupts();
+    TCCR2A = _BV(WGM21); // CTC
+    TCCR2B = _BV(CS22) | _BV(CS21); // prescaler 256
+    OCR2A = F_CPU / 256UL * SAMPLE_MS / 1000 - 1;
+    TCNT2 = 0;
+    TIMSK2 |= _BV(OCIE2A);
+    interrupts();
+  }
+
+  /// Hold the interrupt while the main loop reads the chains (a compare match meanwhile stays pending)
+  static void hold(bool held)
+  {
+    if (held)
+      TIMSK2 &= ~_BV(OCIE2A);
+    else
+      TIMSK2 |= _BV(OCIE2A);
+  }
+
+  /// Interrupt : one sample of the counted bits
+  void isr()
+  {
+    unsigned long start = micros();
+    bool raw[MAX_COUNTERS];
+    read(raw);
+
+    // nb: millis() is safe here, the Timer0 overflow only waits for the end of this interrupt
+    unsigned long now = millis();
+    unsigned long gap = now - _sampleMillis;
+    _sampleMillis = now;
+    for (byte k = 0; k < _count; k++)
+      _counters[k]->Scan(raw[k], gap);
+
+    word cost = micros() - start;
+    if (cost > isrMax)
+      isrMax = cost;
+  }
+
+private:
+  /// Register-level read, same sequence as ShiftInput::readInputsInner() stopped after the deepest counted bit
+  /// nb: ports and masks in locals, the compiler would reload the members after each volatile store ;
+  /// two stores are at least 125 ns apart, longer than the 74HC165 load and clock pulses
+  void read(bool * raw)
+  {
+    volatile uint8_t * plPort = _plPort;
+    volatile uint8_t * cePort = _cePort;
+    volatile uint8_t * clockPort = _clockPort;
+    uint8_t plMask = _plMask;
+    uint8_t ceMask = _ceMask;
+    uint8_t clockMask = _clockMask;
+
+    // parallel load
+    *cePort |= ceMask;
+    *plPort &= ~plMask;
+    *plPort |= plMask;
+    *cePort &= ~ceMask;
+
+    for (byte i = 0; i < _steps; i++)
+    {
+      for (byte k = 0; k < _count; k++)
+        if (_step[k] == i)
+          raw[k] = (*_dataPin[_branch[k]] & _dataMask[_branch[k]]) != 0;
+      // rising edge shifts the next bit
+      *clockPort |= clockMask;
+      *clockPort &= ~clockMask;
+    }
+  }
+};
+
+PulseSampler * PulseSampler::instance = 0;
+
+ISR(TIMER2_COMPA_vect)
+{
+  PulseSampler::instance->isr();
+}
@@ -0,0 +1,298 @@
+/// Replay of a recorded MQTT trace against the CORE logic, with a virtual clock
+///
+/// The trace is fed on the serial line, one message per line :
+///     <millis> <topic> <payload>          e.g.  "1520 MDB/IN/2/0 1"
+/// Timestamps are relative millis, in increasing order. A line "END" prints the summary.
+///
+/// Scripted scenarios add a few keywords in place of the topic :
+///     <millis> LOOPBACK                   the published messages come back to the logic at the next tick, as from the broker
+///     <millis> WATCH <topic>              record the payloads published on the topic
+///     <millis> EXPECT <topic> <p1,p2,..>  assert the payloads recorded since the previous EXPECT (or WATCH), "-" for none
+///     <millis> LAST <topic> <p>           assert the last payload recorded
+///     <millis> RECONNECT                  the next messages are the retained ones replayed by the broker (state only)...
+///     <millis> SYNCED                     ...until our sync marker comes back
+/// e.g. a shutter stopped by a second press, sent to 40 %, with a reconnect during the move (host/scenarios/shutter.replay) :
+///     0 LOOPBACK
+///     0 WATCH MDB/VR/SAL/state
+///     0 WATCH MDB/VR/SAL/pos
+///     0 MDB/VR/SAL/pos 0
+///     1000 MDB/IN/1/6 1
+///     12000 MDB/IN/1/6 1
+///     12100 EXPECT MDB/VR/SAL/state closed,opening,stopped
+///     12100 LAST MDB/VR/SAL/pos 19
+///     13000 MDB/VR/SAL/pos/set 40
+///     20000 RECONNECT
+///     20010 MDB/VR/SAL/pos 30
+///     20020 SYNCED
+///     60000 LAST MDB/VR/SAL/pos 40
+///     60000 EXPECT MDB/VR/SAL/state opening,stopped
+///     END
+/// The virtual clock fast forwards between the lines : a one minute move replays in a fraction of a second.
+/// On a PC : make -C host replay
+///
+/// Capture from the broker (relative timestamps) :
+///     mosquitto_sub -v -t 'MDB/#' | awk '{ "date +%s%3N" | getline t; close("date +%s%3N"); if (!t0) t0 = t; print t - t0, $0; fflush() }'
+///
+/// Output lines (diff two builds outputs to prove they behave the same) :
+///     "> <millis> <topic> <payload> [R]"   message published by the logic (R: retained)
+///     "= <millis> <topic> <us> <publishes>" per message cpu time and publishes generated
+///     "# ..."                               summary and final state
+///     "! <millis> <topic> <expected> <got>" failed EXPECT
+/// Debug prints of the sketch are interleaved : keep the lines starting with '>' and '#' to compare behaviors,
+/// the '=' lines for timings.
+class Replay {
+  /// Virtual time step between two ticks of the logic
+  static const unsigned long STEP_MS = 10;
+  /// Watched topics, and the payloads recorded for each
+  static const byte MAX_WATCHES = 4;
+  static const byte WATCH_TOPIC = 40;
+  static const byte WATCH_RECORD = 64;
+  static const byte WATCH_LAST = 12;
+  /// Published messages on their way back (LOOPBACK)
+  static const byte MAX_LOOPBACK = 8;
+  static const byte LOOPBACK_PAYLOAD = 12;
+
+  struct Watch {
+    char topic[WATCH_TOPIC];
+    /// "p1,p2,..," ("~" at the end when truncated)
+    char record[WATCH_RECORD];
+    char last[WATCH_LAST];
+  };
+  static Watch _watches[MAX_WATCHES];
+  static byte _watchCount;
+  static unsigned int _expects;
+  static unsigned int _failures;
+
+  struct Message {
+    char topic[WATCH_TOPIC];
+    char payload[LOOPBACK_PAYLOAD];
+  };
+  static bool _loopback;
+  static Message _loopbackQueue[MAX_LOOPBACK];
+  static byte _loopbackCount;
+
+  /// Virtual clock
+  static unsigned long _now;
+  /// Current line
+  static char _line[96];
+  static byte _lineLength;
+
+  /// Counters
+  static unsigned long _messages;
+  static unsigned long _publishes;
+  static unsigned long _cpuMicros;
+  static unsigned long _cpuMicrosMax;
+
+  /// Sketch hooks
+  static void (* _callback)(char* topic, byte* payload, unsigned int length);
+  static void (* _tick)();
+  static void (* _dump)();
+  static void (* _sync)(bool syncing);
+
+public:
+  /// Virtual millis()
+  static unsigned long now() { return _now; }
+
+  /// Setup with the MQTT message callback, the logic loop, the final state printer and the sync phase switch
+  static void setup(void (* callback)(char*, byte*, unsigned int), void (* tick)(), void (* dump)(), void (* sync)(bool))
+  {
+    _callback = callback;
+    _tick = tick;
+    _dump = dump;
+    _sync = sync;
+    Serial.println("# REPLAY ready");
+  }
+
+  /// Publish stand-in : trace the message instead of sending it
+  static bool publish(const char * topic, const char * payload, bool retain)
+  {
+    _publishes++;
+    Serial.print("> "); Serial.print(_now); Serial.print(" "); Serial.print(topic); Serial.print(" "); Serial.print(payload);
+    Serial.println(retain ? " R" : "");
+
+    for (byte i = 0; i < _watchCount; i++)
+      if (!strcmp(topic, _watches[i].topic))
+      {
+        char * record = _watches[i].record;
+        size_t length = strlen(record);
+        if (length + strlen(payload) + 2 < WATCH_RECORD)
+          snprintf(record + length, WATCH_RECORD - length, "%s,", payload);
+        else if (length == 0 || record[length - 1] != '~')
+          snprintf(record + min(length, (size_t)WATCH_RECORD - 2), 2, "~");
+        snprintf(_watches[i].last, WATCH_LAST, "%s", payload);
+      }
+
+    if (_loopback)
+    {
+      if (_loopbackCount < MAX_LOOPBACK)
+      {
+        snprintf(_loopbackQueue[_loopbackCount].topic, WATCH_TOPIC, "%s", topic);
+        snprintf(_loopbackQueue[_loopbackCount].payload, LOOPBACK_PAYLOAD, "%s", payload);
+        _loopbackCount++;
+      }
+      else
+        Serial.println("! loopback queue full");
+    }
+    return true;
+  }
+
+  /// Read the serial line and replay the complete lines
+  static void loop()
+  {
+    while (Serial.available() > 0)
+    {
+      char c = Serial.read();
+      if (c == '\r')
+        continue;
+      if (c != '\n')
+      {
+        // nb: too long lines are truncated
+        if (_lineLength < sizeof(_line) - 1)
+          _line[_lineLength++] = c;
+        continue;
+      }
+      _line[_lineLength] = 0;
+      _lineLength = 0;
+      replayLine();
+    }
+  }
+
+private:
+  /// Fast forward the virtual clock, ticking the logic on the way
+  static void advanceTo(unsigned long target)
+  {
+    while ((long)(target - _now) > 0)
+    {
+      _now += min(STEP_MS, target - _now);
+      deliverLoopback();
+      _tick();
+    }
+  }
+
+  /// The messages published before this tick come back (the ones they trigger wait for the next tick)
+  static void deliverLoopback()
+  {
+    byte count = _loopbackCount;
+    Message messages[MAX_LOOPBACK];
+    memcpy(messages, _loopbackQueue, count * sizeof(Message));
+    _loopbackCount = 0;
+    for (byte i = 0; i < count; i++)
+      _callback(messages[i].topic, (byte*)messages[i].payload, strlen(messages[i].payload));
+  }
+
+  static void replayLine()
+  {
+    if (!strcmp(_line, "END"))
+    {
+      Serial.print("# messages="); Serial.print(_messages);
+      Serial.print(" publishes="); Serial.print(_publishes);
+      Serial.print(" cpu_us="); Serial.print(_cpuMicros);
+      Serial.print(" cpu_us_max="); Serial.print(_cpuMicrosMax);
+      Serial.print(" expects="); Serial.print(_expects);
+      Serial.print(" failures="); Serial.println(_failures);
+      _dump();
+      return;
+    }
+
+    // <millis> <topic> [<payload>]
+    char * topic = strchr(_line, ' ');
+    if (topic == NULL)
+      return;
+    *topic++ = 0;
+    char * payload = strchr(topic, ' ');
+    if (payload != NULL)
+      *payload++ = 0;
+    else
+      payload = topic + strlen(topic);
+
+    advanceTo(strtoul(_line, NULL, 10));
+
+    if (scenario(topic, payload))
+      return;
+
+    unsigned long publishes = _publishes;
+    unsigned long start = micros();
+    _callback(topic, (byte*)payload, strlen(payload));
+    unsigned long elapsed = micros() - start;
+
+    _messages++;
+    _cpuMicros += elapsed;
+    _cpuMicrosMax = max(_cpuMicrosMax, elapsed);
+    Serial.print("= "); Serial.print(_now); Serial.print(" "); Serial.print(topic); Serial.print(" ");
+    Serial.print(elapsed); Serial.print(" "); Serial.println(_publishes - publishes);
+  }
+
+  /// Scenario keywords, @return false for a plain message
+  static bool scenario(const char * keyword, char * arguments)
+  {
+    if (!strcmp(keyword, "RECONNECT") || !strcmp(keyword, "SYNCED"))
+    {
+      _sync(keyword[0] == 'R');
+      return true;
+    }
+    if (!strcmp(keyword, "LOOPBACK"))
+    {
+      _loopback = true;
+      return true;
+    }
+    if (!strcmp(keyword, "WATCH"))
+    {
+      if (_watchCount < MAX_WATCHES)
+      {
+        Watch & watch = _watches[_watchCount++];
+        snprintf(watch.topic, WATCH_TOPIC, "%s", arguments);
+        watch.record[0] = 0;
+        strcpy(watch.last, "-");
+      }
+      return true;
+    }
+    bool last = !strcmp(keyword, "LAST");
+    if (!last && strcmp(keyword, "EXPECT"))
+      return false;
+
+    // EXPECT <topic> <p1,p2,...> , LAST <topic> <p>
+    char * expected = strchr(arguments, ' ');
+    if (expected == NULL)
+      return true;
+    *expected++ = 0;
+    for (byte i = 0; i < _watchCount; i++)
+    {
+      if (strcmp(arguments, _watches[i].topic))
+        continue;
+      char * record = _watches[i].record;
+      size_t length = strlen(record);
+      if (!last && length > 0 && record[length - 1] == ',')
+        record[length - 1] = 0;
+      const char * got = last ? _watches[i].last : length > 0 ? record : "-";
+      _expects++;
+      if (strcmp(got, expected))
+      {
+        _failures++;
+        Serial.print("! "); Serial.print(_now); Serial.print(" "); Serial.print(arguments);
+        Serial.print(" "); Serial.print(expected); Serial.print(" "); Serial.println(got);
+      }
+      if (!last)
+        record[0] = 0;
+    }
+    return true;
+  }
+};
+
+unsigned long Replay::_now = 0;
+char Replay::_line[96];
+byte Replay::_lineLength = 0;
+unsigned long Replay::_messages = 0;
+unsigned long Replay::_publishes = 0;
+unsigned long Replay::_cpuMicros = 0;
+unsigned long Replay::_cpuMicrosMax = 0;
+void (* Replay::_callback)(char* topic, byte* payload, unsigned int length) = 0;
+void (* Replay::_tick)() = 0;
+void (* Replay::_dump)() = 0;
+void (* Replay::_sync)(bool syncing) = 0;
+Replay::Watch Replay::_watches[Replay::MAX_WATCHES];
+byte Replay::_watchCount = 0;
+unsigned int Replay::_expects = 0;
+unsigned int Replay::_failures = 0;
+bool Replay::_loopback = false;
+Replay::Message Replay::_loopbackQueue[Replay::MAX_LOOPBACK];
+byte Replay::_loopbackCount = 0;
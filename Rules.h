@@ -0,0 +1,207 @@
+/// Tiny stack based rule engine
+///
+/// Signals are MQTT topics, indexed by their position in a NULL terminated table. Their value is the
+/// last payload received, in hundredths ("1" => 100, "21.5" => 2150). Non zero means true.
+/// The program is a sequence of rules in flash, each one an expression ending by RULE_OUT(signal):
+/// the result is published to the signal topic ("1"/"0") when it changes.
+/// A rule is only evaluated when one of the signals it reads has changed.
+///
+///   // Kitchen VMC trap : switch on AND temperature > 25.00
+///   RULE_SIG(0), RULE_SIG(2), RULE_CONST(2500), RULE_GT, RULE_AND, RULE_OUT(3),
+
+enum RuleOp {
+  RULE_OP_END,
+  /// push signal value (1 byte operand : signal index)
+  RULE_OP_SIG,
+  /// push constant (2 bytes operand : value, big endian)
+  RULE_OP_CONST,
+  RULE_OP_NOT,
+  RULE_OP_AND,
+  RULE_OP_OR,
+  RULE_OP_LT,
+  RULE_OP_GT,
+  RULE_OP_EQ,
+  /// pop and publish to signal (1 byte operand : signal index), ends the rule
+  RULE_OP_OUT
+};
+
+#define RULE_SIG(i)   RULE_OP_SIG, (i)
+#define RULE_CONST(v) RULE_OP_CONST, (byte)(((v) >> 8) & 0xFF), (byte)((v) & 0xFF)
+#define RULE_NOT      RULE_OP_NOT
+#define RULE_AND      RULE_OP_AND
+#define RULE_OR       RULE_OP_OR
+#define RULE_LT       RULE_OP_LT
+#define RULE_GT       RULE_OP_GT
+#define RULE_EQ       RULE_OP_EQ
+#define RULE_OUT(i)   RULE_OP_OUT, (i)
+#define RULE_END      RULE_OP_END
+
+class Rules {
+  /// Fixed limits (RAM is bounded by these)
+  static const byte MAX_SIGNALS = 16;
+  static const byte MAX_RULES = 8;
+  static const byte MAX_STACK = 8;
+  static const int MAX_PROGRAM = 256;
+
+  /// Signal topics, NULL terminated (not owned)
+  const char * const * _signals;
+  /// Program in flash (not owned)
+  const byte * _program;
+
+  byte _signalCount;
+  byte _ruleCount;
+  /// Signal values, in hundredths
+  int _values[MAX_SIGNALS];
+  /// Signals changed since the last evaluation
+  unsigned int _dirty;
+  /// Per rule : program offset, signals read, last published result (-1 : none)
+  int _ruleStart[MAX_RULES];
+  unsigned int _ruleReads[MAX_RULES];
+  signed char _ruleLast[MAX_RULES];
+
+public:
+  Rules(const char * const * signals, const byte * program);
+  /// Setup : index the rules of the program
+  void Setup(bool (* fun)(const char*, const char*, bool));
+  /// MQTT Callback : update the signal values
+  void Callback(char* topic, byte* payload, unsigned int length);
+  /// Common loop : evaluate the rules reading changed signals
+  void Loop();
+
+private:
+  /// Evaluate one rule, @return false if the rule is invalid
+  bool Evaluate(byte rule);
+  /// Operand bytes of an operation
+  static byte OperandLength(byte op) { return op == RULE_OP_CONST ? 2 : (op == RULE_OP_SIG || op == RULE_OP_OUT) ? 1 : 0; }
+
+private:
+  //  static publish function pointer
+  static bool (* publish_generic)(const char * topic, const char * payload, bool retain);
+};
+
+//  static publish function pointer
+bool (* Rules::publish_generic)(const char * topic, const char * payload, bool retain) = 0;
+
+Rules::Rules(const char * const * signals, const byte * program)
+: _signals(signals),
+  _program(program),
+  _signalCount(0),
+  _ruleCount(0),
+  _dirty(0)
+{
+}
+
+void Rules::Setup(bool (* fun)(const char*, const char*, bool))
+{
+  publish_generic = fun;
+
+  while (_signalCount < MAX_SIGNALS && _signals[_signalCount] != NULL)
+  {
+    _values[_signalCount] = 0;
+    _signalCount++;
+  }
+
+  // Split the program in rules, and note which signals each one reads
+  int pc = 0;
+  int start = 0;
+  unsigned int reads = 0;
+  for (;;)
+  {
+    byte op = pgm_read_byte(_program + pc);
+    if (op == RULE_OP_END || op > RULE_OP_OUT || pc + 1 + OperandLength(op) >= MAX_PROGRAM)
+      break;
+    byte operand = pgm_read_byte(_program + pc + 1);
+    if ((op == RULE_OP_SIG || op == RULE_OP_OUT) && operand >= _signalCount)
+      break;
+    if (op == RULE_OP_SIG)
+      reads |= 1U << operand;
+    pc += 1 + OperandLength(op);
+    if (op == RULE_OP_OUT)
+    {
+      if (_ruleCount == MAX_RULES)
+        break;
+      _ruleStart[_ruleCount] = start;
+      _ruleReads[_ruleCount] = reads;
+      _ruleLast[_ruleCount] = -1;
+      _ruleCount++;
+      start = pc;
+      reads = 0;
+    }
+  }
+  if (pgm_read_byte(_program + pc) != RULE_OP_END)
+  {
+    Serial.print("Rules: invalid program at "); Serial.println(pc);
+  }
+  Serial.print("Rules: "); Serial.print(_ruleCount); Serial.print(" rules on "); Serial.print(_signalCount); Serial.println(" signals");
+}
+
+void Rules::Callback(char* topic, byte* payload, unsigned int length)
+{
+  for (byte i = 0; i < _signalCount; i++)
+  {
+    if (strcmp(topic, _signals[i]))
+      continue;
+    int value;
+    if (MqttParse::toCenti(payload, length, value) && value != _values[i])
+    {
+      _values[i] = value;
+      _dirty |= 1U << i;
+    }
+  }
+}
+
+void Rules::Loop()
+{
+  if (_dirty == 0)
+    return;
+  unsigned int dirty = _dirty;
+  _dirty = 0;
+  for (byte r = 0; r < _ruleCount; r++)
+    if (_ruleReads[r] & dirty)
+      Evaluate(r);
+}
+
+bool Rules::Evaluate(byte rule)
+{
+  int stack[MAX_STACK];
+  byte sp = 0;
+  for (int pc = _ruleStart[rule]; ; )
+  {
+    byte op = pgm_read_byte(_program + pc);
+    byte operand = pgm_read_byte(_program + pc + 1);
+    pc += 1 + OperandLength(op);
+
+    // pops : 0 for push operations, 1 for NOT and OUT, 2 otherwise
+    byte pops = (op == RULE_OP_SIG || op == RULE_OP_CONST) ? 0 : (op == RULE_OP_NOT || op == RULE_OP_OUT) ? 1 : 2;
+    if (sp < pops || (pops == 0 && sp == MAX_STACK))
+      return false;
+
+    int b = pops > 0 ? stack[sp - 1] : 0;
+    int a = pops > 1 ? stack[sp - 2] : 0;
+    sp -= pops;
+
+    switch (op)
+    {
+      case RULE_OP_SIG:   stack[sp++] = _values[operand]; break;
+      case RULE_OP_CONST: stack[sp++] = (int)((operand << 8) | pgm_read_byte(_program + pc - 1)); break;
+      case RULE_OP_NOT:   stack[sp++] = !b; break;
+      case RULE_OP_AND:   stack[sp++] = a && b; break;
+      case RULE_OP_OR:    stack[sp++] = a || b; break;
+      case RULE_OP_LT:    stack[sp++] = a < b; break;
+      case RULE_OP_GT:    stack[sp++] = a > b; break;
+      case RULE_OP_EQ:    stack[sp++] = a == b; break;
+      case RULE_OP_OUT:
+        {
+          signed char result = b != 0;
+          if (result != _ruleLast[rule])
+          {
+            _ruleLast[rule] = result;
+            publish_generic(_signals[operand], result ? "1" : "0", true);
+          }
+        }
+        return true;
+      default:
+        return false;
+    }
+  }
+}
@@ -0,0 +1,240 @@
+/// Binary code modulation (BCM) of the 74HC595 outputs, driven by the Timer1 compare interrupt
+///
+/// A frame is 8 planes : plane b holds the bit b of the level of every output, and is shown for
+/// BASE << b. An output of level L (0..255) is therefore on for L/255 of the frame. The outputs not
+/// dimmed are 0 or 255 : the same bit in all the planes.
+/// Each interrupt latches the plane shifted by the previous one, programs its length, then shifts the
+/// next plane with a register-level shifter (no digitalWrite, no shiftOut) while this one is shown.
+/// The shortest plane (BASE) must outlast an interrupt : setup() raises it to the measured cost, see isrMax.
+///
+/// The chain is then owned by the interrupt : ShiftOutput::apply() is no longer used.
+class ShiftDimmer {
+public:
+  static const byte PLANES = 8;
+  /// 64 outputs at most
+  static const byte MAX_CHIPS = 8;
+  /// Timer1 ticks per microsecond (prescaler 8)
+  static const word TICKS_PER_US = F_CPU / 8000000UL;
+  /// Interrupt entry, exit and bookkeeping, on top of the shift (us)
+  static const word ISR_MARGIN_US = 8;
+
+private:
+  volatile uint8_t * _dataPort;
+  volatile uint8_t * _clockPort;
+  volatile uint8_t * _latchPort;
+  uint8_t _dataMask;
+  uint8_t _clockMask;
+  uint8_t _latchMask;
+  byte _chips;
+  /// Plane 0 length (timer ticks)
+  word _baseTicks;
+  /// Planes being written, and shown by the interrupt (copied by apply())
+  byte _planes[PLANES][MAX_CHIPS];
+  byte _shown[PLANES][MAX_CHIPS];
+  /// Plane shifted, shown at the next interrupt
+  byte _plane;
+  /// Interrupts time of the current frame (ticks)
+  word _frameTicks;
+
+public:
+  /// Longest interrupt (ticks), interrupts time of the last frame (ticks) : since the last metrics
+  volatile word isrMax;
+  volatile word frameIsr;
+
+  /// The one driven by the interrupt
+  static ShiftDimmer * instance;
+
+public:
+  /// Same pins as ShiftOutput, chips of 8 outputs in the chain
+  ShiftDimmer(int dataPin, int clockPin, int latchPin, byte chips)
+  : _dataPort(portOutputRegister(digitalPinToPort(dataPin))),
+    _clockPort(portOutputRegister(digitalPinToPort(clockPin))),
+    _latchPort(portOutputRegister(digitalPinToPort(latchPin))),
+    _dataMask(digitalPinToBitMask(dataPin)),
+    _clockMask(digitalPinToBitMask(clockPin)),
+    _latchMask(digitalPinToBitMask(latchPin)),
+    _chips(min(chips, MAX_CHIPS)),
+    _baseTicks(0),
+    _plane(0),
+    _frameTicks(0),
+    isrMax(0),
+    frameIsr(0)
+  {
+    memset(_planes, 0, sizeof(_planes));
+    memset(_shown, 0, sizeof(_shown));
+  }
+
+  /// Level of an output, applied at the next apply() (outputs out of the chain ignored)
+  void setLevel(int output, byte level)
+  {
+    if (output < 0 || output >= _chips * 8)
+      return;
+    byte chip = output >> 3;
+    byte mask = 1 << (output & 7);
+    for (byte b = 0; b < PLANES; b++, level >>= 1)
+    {
+      if (level & 1)
+        _planes[b][chip] |= mask;
+      else
+        _planes[b][chip] &= ~mask;
+    }
+  }
+
+  /// Current level of an output (as set), 0 out of the chain
+  byte level(int output) const
+  {
+    byte level = 0;
+    if (output < 0 || output >= _chips * 8)
+      return level;
+    for (byte b = 0; b < PLANES; b++)
+      if (_planes[b][output >> 3] & (1 << (output & 7)))
+        level |= 1 << b;
+    return level;
+  }
+
+  /// Show the levels set (from the next plane)
+  void apply()
+  {
+    noInterrupts();
+    memcpy(_shown, _planes, sizeof(_shown));
+    interrupts();
+  }
+
+  /// Start the interrupt (the pins are already set up by ShiftOutput)
+  /// @param baseUs length of the shortest plane, the frame lasts 255 times this (raised if shorter than an interrupt)
+  void setup(word baseUs)
+  {
+    TCCR1A = 0;
+    TCCR1B = _BV(WGM12) | _BV(CS11); // CTC, prescaler 8
+    // nb: plane 0 is left in the chain, latched by the first interrupt
+    word minUs = measure() / TICKS_PER_US + ISR_MARGIN_US;
+    if (baseUs < minUs)
+    {
+      Serial.print("Dimmer: base raised to "); Serial.print(minUs); Serial.println(" us");
+      baseUs = minUs;
+    }
+    _baseTicks = baseUs * TICKS_PER_US;
+    _plane = 0;
+    instance = this;
+    Serial.print("Dimmer: "); Serial.print(_chips * 8); Serial.print(" outputs, frame ");
+    Serial.print(255UL * baseUs); Serial.print(" us = "); Serial.print(1000000UL / (255UL * baseUs)); Serial.println(" Hz");
+
+    noInterrupts();
+    TCNT1 = 0;
+    OCR1A = _baseTicks - 1;
+    TIMSK1 |= _BV(OCIE1A);
+    interrupts();
+  }
+
+  /// Interrupt : show the plane shifted before, for its length, and shift the next one
+  void isr()
+  {
+    latch();
+    // nb: CTC, the timer restarted at the compare match : programmed first, before the shift
+    OCR1A = (_baseTicks << _plane) - 1;
+    _plane = (_plane + 1) & (PLANES - 1);
+    shiftPlane(_shown[_plane]);
+
+    word cost = TCNT1;
+    if (cost > isrMax)
+      isrMax = cost;
+    _frameTicks += cost;
+    if (_plane == 0)
+    {
+      frameIsr = _frameTicks;
+      _frameTicks = 0;
+    }
+  }
+
+  /// Stop the interrupt : the chain is free (bench)
+  void pause()
+  {
+    TIMSK1 &= ~_BV(OCIE1A);
+  }
+
+  /// Restart the interrupt after pause() : the plane due is shifted again
+  void resume()
+  {
+    noInterrupts();
+    shiftPlane(_shown[_plane]);
+    TCNT1 = 0;
+    TIMSK1 |= _BV(OCIE1A);
+    interrupts();
+  }
+
+  /// Cost of a plane shift (ticks), interrupt not running : shifted in the chain, not latched
+  word measure()
+  {
+    noInterrupts();
+    word ocr = OCR1A;
+    OCR1A = 0xFFFF;
+    TCNT1 = 0;
+    shiftPlane(_shown[0]);
+    word cost = TCNT1;
+    OCR1A = ocr;
+    interrupts();
+    return cost;
+  }
+
+  /// Interrupts share of the cpu (percent)
+  byte load() const { return _baseTicks == 0 ? 0 : (unsigned long)frameIsr * 100 / (255UL * _baseTicks); }
+
+private:
+  /// Show the shifted plane
+  void latch()
+  {
+    volatile uint8_t * latchPort = _latchPort;
+    uint8_t latchMask = _latchMask;
+    *latchPort |= latchMask;
+    *latchPort &= ~latchMask;
+  }
+
+  /// Register-level shifter, same order as ShiftOutput::apply() : last chip first, LSB first
+  /// nb: ports and masks in locals, the compiler would reload the members after each volatile store
+  void shiftPlane(const byte * plane)
+  {
+    volatile uint8_t * dataPort = _dataPort;
+    volatile uint8_t * clockPort = _clockPort;
+    uint8_t dataMask = _dataMask;
+    uint8_t clockMask = _clockMask;
+
+    if (dataPort == clockPort)
+    {
+      // data and clock on the same port (the board : PORTC) : two stores per bit
+      uint8_t idle = *dataPort & ~(dataMask | clockMask);
+      for (int8_t c = _chips - 1; c >= 0; c--)
+      {
+        byte v = plane[c];
+        for (byte i = 0; i < 8; i++, v >>= 1)
+        {
+          uint8_t out = (v & 1) ? idle | dataMask : idle;
+          *dataPort = out;
+          *dataPort = out | clockMask;
+        }
+      }
+      *dataPort = idle;
+      return;
+    }
+
+    for (int8_t c = _chips - 1; c >= 0; c--)
+    {
+      byte v = plane[c];
+      for (byte i = 0; i < 8; i++, v >>= 1)
+      {
+        if (v & 1)
+          *dataPort |= dataMask;
+        else
+          *dataPort &= ~dataMask;
+        *clockPort |= clockMask;
+        *clockPort &= ~clockMask;
+      }
+    }
+  }
+};
+
+ShiftDimmer * ShiftDimmer::instance = 0;
+
+ISR(TIMER1_COMPA_vect)
+{
+  ShiftDimmer::instance->isr();
+}
@@ -1,334 +1,28 @@
-#define CHAR_BIT 8
-
-
-namespace std{
-  template <size_t N> class bitset;
-
-
-  template <size_t N> bitset<N> operator&(const bitset<N>&, const bitset<N>&);
-  template <size_t N> bitset<N> operator|(const bitset<N>&, const bitset<N>&);
-  template <size_t N> bitset<N> operator^(const bitset<N>&, const bitset<N>&);
-  
-  //Actual Code
-
-
-  template<size_t N> class  bitset {
-  private:
-    //Number of characters allocated to hold the bits
-    static const size_t WORD_SIZE = CHAR_BIT;   //Use int maybe?
-    static const size_t num_bytes = (N + WORD_SIZE - 1) / WORD_SIZE;
-
-    //From the bit number, figure out which byte we are working with
-    size_t byte_num(size_t bit_num) const{ 
-      if(WORD_SIZE == 8){
-        return (bit_num >> 3);
-      }
-      if(WORD_SIZE == 16){
-        return (bit_num >> 4);
-      }
-      if(WORD_SIZE == 32){
-        return (bit_num >> 5);
-      }
-      if(WORD_SIZE == 64){
-        return (bit_num >> 6);
-      }
-      return bit_num / WORD_SIZE;
-    }
-    //From the bit number, figure out which bit inside the byte we need
-    size_t bit_num(const size_t bit_num) const{
-      return bit_num % WORD_SIZE;
-    }
-
-
-    //Point to the actual data
-    char data[num_bytes];
-    
-  public:
-#if 0
-    class  reference {
-      friend class bitset;
-      reference() : bit_num(0), parent(0) {  }
-      size_t bit_num;
-      bitset * parent;
-    public:
-      ~reference() {  }
-      reference& operator=(bool x){     // for b[i] = x;
-        parent->set(bit_num, x);
-        return *this;
-      }
-      reference& operator=(const reference& x){ // for b[i] = b[j];
-        parent->set(bit_num, x);
-        return *this;
-      }
-      bool operator~() const{       // flips the bit
-        return !parent->test(bit_num);
-      }
-      operator bool() const{        // for x = b[i];
-        return parent->test(bit_num);
-      }
-      reference& flip(){        // for b[i].flip();
-        parent->flip(bit_num);
-        return *this;
-      }
-    };
-#endif
-
-    bitset(){
-      //Serial.print("Constructing new bitset N=");Serial.print(N); Serial.print(" 0x");Serial.println((int)this, HEX);
-      
-      reset();
-    }
-    bitset(unsigned long val){
-      reset();
-      size_t count = sizeof(val) * CHAR_BIT;
-      if(count > N){
-        count = N;
-      }
-      for(size_t i = 0; i < count; ++i){
-        set(i, ((val >> i) & 1));
-      }
-    }
-
-    bitset(const bitset & val){
-      //Serial.print("Constructing bitset N=");Serial.print(N); Serial.print(" 0x");Serial.print((int)this, HEX);Serial.print(" from another ");Serial.println((int)(&val),HEX);
-      for(size_t i = 0; i < num_bytes; ++i){
-        data[i] = val.data[i];
-      }
-    }
-    /*
-    ~bitset()
-    {
-      //Serial.print("Destructing bitset N=");Serial.print(N); Serial.print(" 0x");Serial.println((int)this, HEX);      
-    }
-    */
-
-    bitset<N>& operator&=(const bitset<N>& rhs){
-      for(size_t i =0; i < num_bytes; ++i){
-        data[i] &= rhs.data[i];
-      }
-      return *this;
-    }
-
-    bitset<N>& operator|=(const bitset<N>& rhs){
-      for(size_t i =0; i < num_bytes; ++i){
-        data[i] |= rhs.data[i];
-      }
-      return *this;
-    }
-    bitset<N>& operator^=(const bitset<N>& rhs){
-      for(size_t i=0; i < num_bytes; ++i){
-        data[i] ^= rhs.data[i];
-      }
-      return *this;
-    }
-
-    bitset<N>& operator<<=(size_t pos){
-      for(size_t i = N-1; i >=pos; --i){
-        set(i, test(i - pos));
-      }
-      for(size_t i = 0; i < pos; ++i){
-        reset(i);
-      }
-      return *this;
-    }
-
-    bitset<N>& operator>>=(size_t pos){
-      for(size_t i = 0; i < (N - pos); ++i){
-        set(i, test(i + pos));
-      }
-      for(size_t i = pos; i > 0; --i){
-        reset(N - i);
-      }
-      return *this;
-    }
-
-    bitset<N>& set(){
-      size_t i;
-      for(i = 0; i < N ; ++i){
-        data[byte_num(i)] |= (1<<bit_num(i));
-      }
-      return *this;
-    }
-    bitset<N>& set(size_t pos, int val = true){
-      if(val == true){
-        data[byte_num(pos)] |= (1<<bit_num(pos));
-      }else{
-        data[byte_num(pos)] &= ~(1<<bit_num(pos));
-      }
-      return *this;
-    }
-    bitset<N>& reset(){
-      for(size_t i = 0; i < num_bytes; ++i){
-        data[i] = 0;
-      }
-      return *this;
-    }
-    bitset<N>& reset(size_t pos){
-      data[byte_num(pos)] &= ~(1<<bit_num(pos));
-      return *this;
-    }
-    bitset<N>  operator~() const{
-      bitset<N> retval(*this);
-      retval.flip();
-      return retval;
-    }
-
-    bitset<N>& flip(){
-      for(size_t i = 0; i < num_bytes; ++i){
-        data[i] =  ~data[i];
-      }
-      return *this;
-    }
-    bitset<N>& flip(size_t pos){
-      char temp = data[byte_num(pos)] & (1 << bit_num(pos));
-      if(temp == 0){  //Bit was 0
-        data[byte_num(pos)] |= (1 << bit_num(pos));
-      }else{    //Bit was 1
-        data[byte_num(pos)] &= ~(1<<bit_num(pos));
-      }
-      return *this;
-    }
-#if 0
-    reference operator[](size_t pos){   // for b[i];
-      reference retval;
-      retval.parent = this;
-      retval.bit_num = pos;
-      return retval;
-    }
-#endif
-
-    unsigned long to_ulong() const{
-      if(N > sizeof(unsigned long) * CHAR_BIT){
-        // __throw_overflow_error();
-      }
-      unsigned long retval = 0;
-      size_t count = N;
-      for(size_t i = count; i > 0; --i){
-        if(test(i)){
-          retval +=1;
-        }
-        retval<<=1;
-      }
-      if(test(0)){
-        retval +=1;
-      }
-      return retval;
-    }
-
-    void print(HardwareSerial & serial)
-    {
-      for(size_t i = N ; i > 0; --i){
-        if(test(i-1) == true){
-          serial.print("1");
-        }else{
-          serial.print("0");
-        }
-      }    
-    }    
-
-    size_t count() const{
-      size_t retval = 0;
-      for(size_t i =0; i < N; ++i){
-        if(test(i)){
-          ++retval;
-        }
-      }
-      return retval;
-    }
-    size_t size()  const{
-      return N;
-    }
-
-    bitset<N>& operator=(const bitset<N> & rhs){
-      //Serial.print("Affecting bitset N=");Serial.print(N); Serial.print(" 0x");Serial.print((int)this, HEX);Serial.print(" from another ");Serial.println((int)(&rhs),HEX);
-      
-      if(&rhs == this){
-        return *this;
-      }
-      //for(size_t i = 0; i <= byte_num(N); ++i)
-      for(size_t i =0; i< num_bytes; ++i){      
-        data[i] = rhs.data[i];
-      }
-      return *this;
-    }
-
-
-    bool operator==(const bitset<N>& rhs) const{
-      for(size_t i =0; i< N; ++i){
-        if(test(i) != rhs.test(i)){
-          return false;
-        }
-      }
-      return true;
-    }
-
-    bool operator!=(const bitset<N>& rhs) const{
-      for(size_t i =0; i< N; ++i){
-        if(test(i) != rhs.test(i)){
-          return true;
-        }
-      }
-      return false;
-    }
+//fwd
+int freeRam();
 
-    bool test(size_t pos) const{
-      return (data[byte_num(pos)] & (1<<bit_num(pos)) ) != 0;
-    }
+/// Largest topology read by an input node : 4 chained chips of 32 bits, or 3 branches of 32 bits
+#define SHIFT_INPUT_MAX_BITS 128
+#define SHIFT_INPUT_MAX_BRANCHES 3
+#define SHIFT_INPUT_WORDS (SHIFT_INPUT_MAX_BITS / 32)
 
-    bool any() const{
-      for(size_t i = 0; i< N; ++i){
-        if(test(i)==true){
-          return true;
-        }
-      }
-      return false;
-    }
+/// Input bits, as 32 bits words (only the words of the configured topology are used)
+struct InputBits
+{
+  unsigned long w[SHIFT_INPUT_WORDS];
 
-    bool none() const{
-      if(any() == true){
+  void reset(byte words) { for (byte i = 0; i < words; i++) w[i] = 0; }
+  void set(int index) { w[index >> 5] |= 1UL << (index & 31); }
+  bool test(int index) const { return (w[index >> 5] >> (index & 31)) & 1; }
+  bool equals(const InputBits & other, byte words) const
+  {
+    for (byte i = 0; i < words; i++)
+      if (w[i] != other.w[i])
         return false;
-      }
-      return true;
-    }
-
-    bitset<N> operator<<(size_t pos) const{
-      bitset retval(*this);
-      retval<<=pos;
-      return retval;
-    }
-    bitset<N> operator>>(size_t pos) const{
-      bitset retval(*this);
-      retval>>=pos;
-      return retval;
-    }
-  };
-
-  //Non-member functions
-
-
-  template <size_t N>  bitset<N> operator&(const bitset<N>& lhs, const bitset<N>& rhs){
-    bitset<N> retval(lhs);
-    retval &= rhs;
-    return retval;
-  }
-
-  template <size_t N>  bitset<N> operator|(const bitset<N>& lhs, const bitset<N>& rhs){
-    bitset<N> retval(lhs);
-    retval |= rhs;
-    return retval;
+    return true;
   }
-
-  template <size_t N>  bitset<N> operator^(const bitset<N>& lhs, const bitset<N>& rhs){
-    bitset<N> retval(lhs);
-    retval ^= rhs;
-    return retval;
-  }
-
-
-}//std
-
-//fwd
-int freeRam();
+  void copy(const InputBits & other, byte words) { for (byte i = 0; i < words; i++) w[i] = other.w[i]; }
+};
 
 /// Common interface without templates
 class IShiftCommon
@@ -339,8 +33,9 @@ class IShiftCommon
   virtual void loop() = 0;
 };
 
-/// Raw reading of BITS bits of input x INS entries = OUT total bits read
-template <size_t BITS, size_t INS, size_t OUTS> class ShiftInput : public IShiftCommon
+/// Raw reading of 'bits' bits of input x 'branches' entries = bits x branches total bits read
+/// The topology is a runtime setting (DIP switches), one engine for all of them.
+class ShiftInput : public IShiftCommon
 {
   /// Delay for loading data in the input chips
   const int PULSE_WIDTH_USEC = 5;
@@ -353,49 +48,87 @@ template <size_t BITS, size_t INS, size_t OUTS> class ShiftInput : public IShift
   /// Clock Enable
   byte m_clockEnablePin;
   /// Data
-  byte m_dataPin[INS];
+  byte m_dataPin[SHIFT_INPUT_MAX_BRANCHES];
   /// Clock
   byte m_clockPin;
   /// Callback event on modified input
   triggerEventCallback m_callbackTrigger;
 
+  /// Topology : bits per branch, branches, total bits and 32 bits words used
+  byte m_bits;
+  byte m_branches;
+  byte m_outs;
+  byte m_words;
+
   /// the debounce time; increase if the output flickers
-  const long debounceDelay = 30;    
+  const long debounceDelay = 30;
   /// event times for deboucing
   long m_lastDebounceTime;
   /// Bitfield: current official button states
-  std::bitset<OUTS>  m_buttonState;
+  InputBits  m_buttonState;
   /// Bitfield: last state read (before debouncing)
-  std::bitset<OUTS>  m_lastButtonRead;   
-  
- 
+  InputBits  m_lastButtonRead;
+  /// Bitfield: inputs counted as pulses (no events)
+  InputBits  m_counted;
+  /// Called around each read of the chains, NULL : none (an interrupt sharing the chains)
+  void (* m_hold)(bool held);
+
+
   public:
-  
+
   /** Initialize
-   *  @param ploadPin pin number for PARALLEL LOAD 
+   *  @param ploadPin pin number for PARALLEL LOAD
    *  @param clockEnablePin pin for CLOCK ENABLE
-   *  @param dataPins Array of DATA pins
+   *  @param dataPins Array of DATA pins (one per branch)
    *  @param clockPin CLOCK pin
    */
-  ShiftInput(triggerEventCallback & callbackTrigger, int ploadPin,int clockEnablePin,int clockPin, const int (&dataPins)[INS])
+  template<size_t N> ShiftInput(triggerEventCallback & callbackTrigger, int ploadPin,int clockEnablePin,int clockPin, const int (&dataPins)[N])
   : m_ploadPin(ploadPin),
     m_clockEnablePin(clockEnablePin),
     m_clockPin(clockPin),
-    m_callbackTrigger(callbackTrigger)
-  { 
-    for (int j = 0; j < INS; j++)  //initialize from array initializer
+    m_callbackTrigger(callbackTrigger),
+    m_bits(32),
+    m_branches(1),
+    m_outs(32),
+    m_words(1),
+    m_hold(NULL)
+  {
+    static_assert(N <= SHIFT_INPUT_MAX_BRANCHES, "Too many branches");
+    m_counted.reset(SHIFT_INPUT_WORDS);
+    for (int j = 0; j < N; j++)  //initialize from array initializer
         m_dataPin[j] = dataPins[j];
   }
-  
+
+  /// Debounced state, as published
+  const InputBits & state() const { return m_buttonState; }
+  /// 32 bits words used by the topology
+  byte words() const { return m_words; }
+  /// Bits read on each branch, total bits read
+  byte bits() const { return m_bits; }
+  byte outs() const { return m_outs; }
+  /// Count an input as pulses : no more events for it (sampled by PulseSampler)
+  void count(int index) { m_counted.set(index); }
+  /// Function called with true before each read of the chains, false after
+  void hold(void (* fun)(bool held)) { m_hold = fun; }
+
+  /// Topology, before setup() : bits read sequentially on each branch (32 per chip), number of branches
+  void configure(byte bits, byte branches)
+  {
+    m_bits = min(bits, SHIFT_INPUT_MAX_BITS);
+    m_branches = constrain(branches, 1, min(SHIFT_INPUT_MAX_BRANCHES, SHIFT_INPUT_MAX_BITS / m_bits));
+    m_outs = m_bits * m_branches;
+    m_words = (m_outs + 31) / 32;
+  }
+
   virtual void setup()
   {
-    Serial.print("Setting up stuff : ");Serial.print(INS);Serial.print(" branch(s) ");Serial.print(BITS);Serial.print(" bits = total ");Serial.println(OUTS);
+    Serial.print("Setting up stuff : ");Serial.print(m_branches);Serial.print(" branch(s) ");Serial.print(m_bits);Serial.print(" bits = total ");Serial.println(m_outs);
     pinMode(m_ploadPin, OUTPUT);
     pinMode(m_clockEnablePin, OUTPUT);
     pinMode(m_clockPin, OUTPUT);
-    for (int j = 0; j < INS; j++)
+    for (int j = 0; j < m_branches; j++)
       pinMode(m_dataPin[j], INPUT);
-    
+
     digitalWrite(m_clockPin, LOW);
     digitalWrite(m_ploadPin, HIGH);
     delayMicroseconds(PULSE_WIDTH_USEC);
@@ -404,36 +137,35 @@ template <size_t BITS, size_t INS, size_t OUTS> class ShiftInput : public IShift
     Serial.println(freeRam());
 
     m_lastDebounceTime =0L;
-    m_buttonState.reset();
-    m_buttonState = readInputs();
-    //functionCall();
-    //readInputsInner();
-    m_lastButtonRead = m_buttonState;          
+    readInputs(m_buttonState);
+    for (byte w = 0; w < m_words; w++)
+      m_buttonState.w[w] &= ~m_counted.w[w];
+    m_lastButtonRead.copy(m_buttonState, m_words);
     Serial.println("First read done... ");
   }
 
   /// Read everything with anti-parasite protection
-  std::bitset<OUTS> readInputs()
+  void readInputs(InputBits & i1)
   {
     #if 1
     // Read 3 times for anti-parasite protect !
-    std::bitset<OUTS> i1, i2, i3;
+    InputBits i2, i3;
     do {
-      i1 = readInputsInner();  
-      i2 = readInputsInner();  
-      i3 = readInputsInner();
-    } while(i1 != i2 || i2 != i3);
+      readInputsInner(i1);
+      readInputsInner(i2);
+      readInputsInner(i3);
+    } while(!i1.equals(i2, m_words) || !i2.equals(i3, m_words));
 #else
-    std::bitset<OUTS> i1 = readInputsInner();  
-
+    readInputsInner(i1);
 #endif
-    return i1;
-  } 
+  }
 
   /// Read all chains of inputs and flatten all the resulting bits
-  std::bitset<OUTS> readInputsInner()
+  void readInputsInner(InputBits & bytesVal)
   {
-    std::bitset<OUTS> bytesVal;
+    bytesVal.reset(m_words);
+    if (m_hold)
+      m_hold(true);
 
     /* Trigger a parallel Load to latch the state of the data lines,
     */
@@ -445,48 +177,46 @@ template <size_t BITS, size_t INS, size_t OUTS> class ShiftInput : public IShift
 
     /* Loop to read each bit value from the serial out line
      * of the SN74HC165N.
-     * 
+     *
      * [ BITS ] --- sequential data to read
-     * 
+     *
      * [ BITS ] [ BITS ] ... [ BITS ]
      *       \     |         /
      *          'INS' BRANCHES
-     *          
+     *
      *  OUTS resulting bits
      *  [ BITS ] + [ BITS ] ... + [ BITS]
     */
-    for(int i = 0; i < BITS; i++)
+    for(int i = 0; i < m_bits; i++)
     {
         int offset_bits = 0;
-        for (int j = 0; j < INS; j++)
+        for (int j = 0; j < m_branches; j++)
         {
-          long bitVal = digitalRead(m_dataPin[j]);
-          //Serial.print("Setting bit #");Serial.print((BITS - 1) - i + offset_bits);Serial.print(" to ");Serial.println(bitVal);
-
           // The bits are read 0 first 31 last...
           auto index = i + offset_bits;
 
 #ifdef HACK_FIX_LAST_TWO_BITS // Hardware V2.1
           index = (index & ~3) | ((index ^ 3) & 3);
-#endif          
+#endif
           // If the bits were read 31 first, 0 last :
           //auto index = (BITS - 1) - i + offset_bits;
-          bytesVal.set(index, bitVal != 0);
-          
+          if (digitalRead(m_dataPin[j]) != 0)
+            bytesVal.set(index);
+
           // nb: Offset addition to avoid a multiply
-          offset_bits += BITS;         
+          offset_bits += m_bits;
         }
-        
+
         /* Pulse the Clock (rising edge shifts the next bit).
         */
         digitalWrite(m_clockPin, HIGH);
         delayMicroseconds(PULSE_WIDTH_USEC);
         digitalWrite(m_clockPin, LOW);
     }
+    if (m_hold)
+      m_hold(false);
     // Delay Between polls
     //delayMicroseconds(1000);
-
-    return(bytesVal);
   }
 
 
@@ -494,53 +224,54 @@ template <size_t BITS, size_t INS, size_t OUTS> class ShiftInput : public IShift
     /// Boucle pour tester les entrées
     virtual void loop()
     {
-      std::bitset<OUTS> reading = readInputs();
+      InputBits reading;
+      readInputs(reading);
+      for (byte w = 0; w < m_words; w++)
+        reading.w[w] &= ~m_counted.w[w];
 
       // If the switch changed, due to noise or pressing:
-      if (reading != m_lastButtonRead) {
+      if (!reading.equals(m_lastButtonRead, m_words)) {
         // reset the debouncing timer
         m_lastDebounceTime = millis();
-
-        //Serial.print("?[");reading.print(Serial);Serial.println("]");
-      } 
+      }
       else if ((millis() - m_lastDebounceTime) > debounceDelay) { // debounce
         // whatever the reading is at, it's been there for longer
         // than the debounce delay, so take it as the actual current state:
-          
+
         // if the button state has changed:
-        if (reading != m_buttonState) {         
-          std::bitset<OUTS> previous = m_buttonState;
-          
+        if (!reading.equals(m_buttonState, m_words)) {
           // Trigger event(s)
-          if (triggerEvent(previous, reading))
+          if (triggerEvent(m_buttonState, reading))
           {
             // Memorize only if publish successful !
-            m_buttonState = reading;
+            m_buttonState.copy(reading, m_words);
           }
         }
       }
-      m_lastButtonRead = reading;
+      m_lastButtonRead.copy(reading, m_words);
 
     }
-    
+
     /// Trigger event for each variation
-    bool triggerEvent(std::bitset<OUTS> & previousFlags, std::bitset<OUTS> & currentFlags)
+    bool triggerEvent(const InputBits & previousFlags, const InputBits & currentFlags)
     {
       bool ok = true;
-#if 0
-      Serial.print("<[");previousFlags.print(Serial);Serial.println("]");
-      Serial.print(">[");currentFlags.print(Serial);Serial.println("]");
-#endif
-      for (int n = 0; n < OUTS && ok; n++)
+      // Only visit the changed bits, a word at a time
+      for (byte w = 0; w < m_words && ok; w++)
       {
-        // Compare Nth bit
-        auto current = currentFlags.test(n);
-        if (previousFlags.test(n) != current)
+        unsigned long changed = previousFlags.w[w] ^ currentFlags.w[w];
+        for (byte b = 0; changed != 0 && ok; b++, changed >>= 1)
+        {
           // message on variation
-          ok = m_callbackTrigger(n, current);
+          if (changed & 1)
+          {
+            int n = w * 32 + b;
+            ok = m_callbackTrigger(n, currentFlags.test(n));
+          }
+        }
       }
       return ok;
     }
-    
-  
+
+
 };
@@ -0,0 +1,182 @@
+#include <Wire.h>
+
+/// Text mode SSD1306 (128x64, I2C) : 8 rows of 21 characters, 5x7 font (upper case)
+///
+/// A shadow of the characters on screen is kept : only the changed runs of characters are sent,
+/// at most one frame every FRAME_MS, and at most MAX_CELLS characters per frame, so the I2C traffic
+/// (~1 ms per 14 characters at 400 kHz) never blocks the MQTT processing for long.
+class Ssd1306Text {
+public:
+  static const byte ROWS = 8;
+  static const byte COLS = 21;
+
+private:
+  /// Frame rate cap
+  static const unsigned long FRAME_MS = 100;
+  /// Characters sent per frame, at most
+  static const byte MAX_CELLS = 42;
+  /// Glyph width (5 columns + 1 space)
+  static const byte GLYPH = 6;
+  /// Characters per I2C transmission (Wire buffer : 32 bytes, including the control byte)
+  static const byte CHUNK = 5;
+
+  byte _address;
+  /// Wanted text, and text on screen
+  char _text[ROWS][COLS];
+  char _shown[ROWS][COLS];
+  unsigned long _frameMillis;
+
+public:
+  /// I2C data bytes sent, since boot
+  unsigned long bytesSent;
+
+public:
+  Ssd1306Text(byte address = 0x3C) : _address(address), _frameMillis(0), bytesSent(0)
+  {
+    memset(_text, ' ', sizeof(_text));
+    memset(_shown, ' ', sizeof(_shown));
+  }
+
+  /// Init the controller and clear the screen (the only full frame)
+  void setup()
+  {
+    Wire.begin();
+    Wire.setClock(400000);
+    static const byte init[] PROGMEM = {
+      0xAE,             // display off
+      0xD5, 0x80,       // clock
+      0xA8, 0x3F,       // multiplex : 64 lines
+      0xD3, 0x00,       // offset
+      0x40,             // start line
+      0x8D, 0x14,       // charge pump
+      0x20, 0x00,       // horizontal addressing
+      0xA1, 0xC8,       // segment remap, COM scan direction
+      0xDA, 0x12,       // COM pins
+      0x81, 0xCF,       // contrast
+      0xD9, 0xF1,       // precharge
+      0xDB, 0x40,       // VCOM detect
+      0xA4, 0xA6,       // display RAM, normal
+      0xAF              // display on
+    };
+    for (byte i = 0; i < sizeof(init); i++)
+      command(pgm_read_byte(init + i));
+
+    window(0, ROWS - 1, 0, 127);
+    for (int i = 0; i < 128 * ROWS; i += 16)
+    {
+      Wire.beginTransmission(_address);
+      Wire.write(0x40);
+      for (byte j = 0; j < 16; j++)
+        Wire.write((byte)0);
+      Wire.endTransmission();
+    }
+  }
+
+  /// Text of a row (cut or padded with spaces), sent at the next frames if changed
+  void print(byte row, const char * text)
+  {
+    if (row >= ROWS)
+      return;
+    bool end = false;
+    for (byte col = 0; col < COLS; col++)
+    {
+      end = end || text[col] == 0;
+      _text[row][col] = end ? ' ' : text[col];
+    }
+  }
+
+  /// Common loop : send the changed characters, within the frame budget
+  void loop()
+  {
+    if (millis() - _frameMillis < FRAME_MS)
+      return;
+    _frameMillis = millis();
+
+    byte budget = MAX_CELLS;
+    for (byte row = 0; row < ROWS && budget > 0; row++)
+    {
+      byte col = 0;
+      while (col < COLS && budget > 0)
+      {
+        if (_text[row][col] == _shown[row][col])
+        {
+          col++;
+          continue;
+        }
+        // run of changed characters (nb: an unchanged one inside the run is cheaper to resend than a new window)
+        byte end = col + 1;
+        while (end < COLS && end - col < budget && (_text[row][end] != _shown[row][end] || (end + 1 < COLS && _text[row][end + 1] != _shown[row][end + 1])))
+          end++;
+        send(row, col, end - col);
+        budget -= end - col;
+        col = end;
+      }
+    }
+  }
+
+private:
+  void command(byte c)
+  {
+    Wire.beginTransmission(_address);
+    Wire.write(0x00);
+    Wire.write(c);
+    Wire.endTransmission();
+  }
+
+  /// Drawing window : pages (rows) and columns
+  void window(byte firstRow, byte lastRow, byte first, byte last)
+  {
+    command(0x21); command(first); command(last);
+    command(0x22); command(firstRow); command(lastRow);
+  }
+
+  /// Send the characters of a run, and update the shadow
+  void send(byte row, byte col, byte length)
+  {
+    window(row, row, col * GLYPH, (col + length) * GLYPH - 1);
+    for (byte i = 0; i < length; i += CHUNK)
+    {
+      Wire.beginTransmission(_address);
+      Wire.write(0x40);
+      for (byte j = i; j < length && j < i + CHUNK; j++)
+      {
+        char c = _text[row][col + j];
+        _shown[row][col + j] = c;
+        const byte * glyph = glyphOf(c);
+        for (byte k = 0; k < GLYPH - 1; k++)
+          Wire.write(pgm_read_byte(glyph + k));
+        Wire.write((byte)0);
+        bytesSent += GLYPH;
+      }
+      Wire.endTransmission();
+    }
+  }
+
+  /// 5x7 glyph of a character (lower case shown as upper case, unknown as '?')
+  static const byte * glyphOf(char c)
+  {
+    static const byte font[] PROGMEM = {
+      0x00,0x00,0x00,0x00,0x00, 0x00,0x00,0x5F,0x00,0x00, 0x00,0x07,0x00,0x07,0x00, 0x14,0x7F,0x14,0x7F,0x14, //  !"#
+      0x24,0x2A,0x7F,0x2A,0x12, 0x23,0x13,0x08,0x64,0x62, 0x36,0x49,0x55,0x22,0x50, 0x00,0x05,0x03,0x00,0x00, // $%&'
+      0x00,0x1C,0x22,0x41,0x00, 0x00,0x41,0x22,0x1C,0x00, 0x08,0x2A,0x1C,0x2A,0x08, 0x08,0x08,0x3E,0x08,0x08, // ()*+
+      0x00,0x50,0x30,0x00,0x00, 0x08,0x08,0x08,0x08,0x08, 0x00,0x60,0x60,0x00,0x00, 0x20,0x10,0x08,0x04,0x02, // ,-./
+      0x3E,0x51,0x49,0x45,0x3E, 0x00,0x42,0x7F,0x40,0x00, 0x42,0x61,0x51,0x49,0x46, 0x21,0x41,0x45,0x4B,0x31, // 0123
+      0x18,0x14,0x12,0x7F,0x10, 0x27,0x45,0x45,0x45,0x39, 0x3C,0x4A,0x49,0x49,0x30, 0x01,0x71,0x09,0x05,0x03, // 4567
+      0x36,0x49,0x49,0x49,0x36, 0x06,0x49,0x49,0x29,0x1E, 0x00,0x36,0x36,0x00,0x00, 0x00,0x56,0x36,0x00,0x00, // 89:;
+      0x08,0x14,0x22,0x41,0x00, 0x14,0x14,0x14,0x14,0x14, 0x00,0x41,0x22,0x14,0x08, 0x02,0x01,0x51,0x09,0x06, // <=>?
+      0x32,0x49,0x79,0x41,0x3E, 0x7E,0x11,0x11,0x11,0x7E, 0x7F,0x49,0x49,0x49,0x36, 0x3E,0x41,0x41,0x41,0x22, // @ABC
+      0x7F,0x41,0x41,0x22,0x1C, 0x7F,0x49,0x49,0x49,0x41, 0x7F,0x09,0x09,0x09,0x01, 0x3E,0x41,0x49,0x49,0x7A, // DEFG
+      0x7F,0x08,0x08,0x08,0x7F, 0x00,0x41,0x7F,0x41,0x00, 0x20,0x40,0x41,0x3F,0x01, 0x7F,0x08,0x14,0x22,0x41, // HIJK
+      0x7F,0x40,0x40,0x40,0x40, 0x7F,0x02,0x0C,0x02,0x7F, 0x7F,0x04,0x08,0x10,0x7F, 0x3E,0x41,0x41,0x41,0x3E, // LMNO
+      0x7F,0x09,0x09,0x09,0x06, 0x3E,0x41,0x51,0x21,0x5E, 0x7F,0x09,0x19,0x29,0x46, 0x46,0x49,0x49,0x49,0x31, // PQRS
+      0x01,0x01,0x7F,0x01,0x01, 0x3F,0x40,0x40,0x40,0x3F, 0x1F,0x20,0x40,0x20,0x1F, 0x3F,0x40,0x38,0x40,0x3F, // TUVW
+      0x63,0x14,0x08,0x14,0x63, 0x07,0x08,0x70,0x08,0x07, 0x61,0x51,0x49,0x45,0x43, 0x00,0x7F,0x41,0x41,0x00, // XYZ[
+      0x02,0x04,0x08,0x10,0x20, 0x00,0x41,0x41,0x7F,0x00, 0x04,0x02,0x01,0x02,0x04, 0x40,0x40,0x40,0x40,0x40  // \]^_
+    };
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    if (c < ' ' || c > '_')
+      c = '?';
+    return font + (c - ' ') * 5;
+  }
+};
@@ -0,0 +1,123 @@
+/// Hashed timer wheel : fixed slots, static storage
+///
+/// A timer is stored in the slot of its deadline tick. Each loop only visits the slots of the ticks
+/// elapsed since the previous loop (usually just the current one), so the cost is proportional to the
+/// timers due, not to the number of objects which could arm one. Deadlines beyond one turn of the wheel
+/// simply stay in their slot until the right turn. Deadlines use the rollover safe (now - deadline) arithmetic.
+class TimerWheel {
+public:
+  typedef void (* Callback)(void * context);
+  /// Invalid timer handle
+  static const byte NO_TIMER = 0xFF;
+
+private:
+  /// 64 slots of 16 ms : one turn is ~1 s
+  static const byte SLOTS = 64;
+  static const byte TICK_SHIFT = 4;
+  /// Timers pool
+  static const byte MAX_TIMERS = 16;
+
+  struct Timer {
+    unsigned long deadline;
+    Callback callback;
+    void * context;
+    /// slot holding the timer
+    byte slot;
+    /// next timer in the slot, or in the free list
+    byte next;
+  };
+
+  Timer _timers[MAX_TIMERS];
+  byte _slots[SLOTS];
+  byte _free;
+  /// last tick visited
+  unsigned long _tick;
+
+public:
+  TimerWheel() : _free(0), _tick(0)
+  {
+    for (byte i = 0; i < SLOTS; i++)
+      _slots[i] = NO_TIMER;
+    for (byte i = 0; i < MAX_TIMERS; i++)
+      _timers[i].next = i + 1 < MAX_TIMERS ? i + 1 : NO_TIMER;
+  }
+
+  /// Arm a timer at an absolute millis() deadline
+  /// @return the timer handle, NO_TIMER if the pool is exhausted
+  byte arm(unsigned long deadline, Callback callback, void * context)
+  {
+    byte t = _free;
+    if (t == NO_TIMER)
+    {
+      Serial.println("TimerWheel: no more timers");
+      return NO_TIMER;
+    }
+    _free = _timers[t].next;
+
+    _timers[t].deadline = deadline;
+    _timers[t].callback = callback;
+    _timers[t].context = context;
+    // nb: a deadline already passed goes to the current slot, fired at the next loop
+    unsigned long now = millis();
+    byte s = slot((long)(deadline - now) > 0 ? deadline : now);
+    _timers[t].slot = s;
+    _timers[t].next = _slots[s];
+    _slots[s] = t;
+    return t;
+  }
+
+  /// Cancel an armed timer (no effect on NO_TIMER)
+  void cancel(byte t)
+  {
+    if (t == NO_TIMER)
+      return;
+    for (byte * link = &_slots[_timers[t].slot]; *link != NO_TIMER; link = &_timers[*link].next)
+      if (*link == t)
+      {
+        *link = _timers[t].next;
+        _timers[t].next = _free;
+        _free = t;
+        return;
+      }
+  }
+
+  /// Common loop : fire the due timers
+  void loop()
+  {
+    unsigned long now = millis();
+    unsigned long nowTick = now >> TICK_SHIFT;
+    // catch up the elapsed ticks (at most one turn), the current one is visited at each loop
+    if (nowTick - _tick >= SLOTS)
+      _tick = nowTick - SLOTS + 1;
+    for (;;)
+    {
+      fireSlot(slot(_tick << TICK_SHIFT), now);
+      if (_tick == nowTick)
+        break;
+      _tick++;
+    }
+  }
+
+private:
+  static byte slot(unsigned long deadline) { return (deadline >> TICK_SHIFT) % SLOTS; }
+
+  void fireSlot(byte s, unsigned long now)
+  {
+    byte * link = &_slots[s];
+    while (*link != NO_TIMER)
+    {
+      byte t = *link;
+      if ((long)(now - _timers[t].deadline) < 0)
+      {
+        // later turn
+        link = &_timers[t].next;
+        continue;
+      }
+      // unlink and free before the callback, which may arm again
+      *link = _timers[t].next;
+      _timers[t].next = _free;
+      _free = t;
+      _timers[t].callback(_timers[t].context);
+    }
+  }
+};
@@ -0,0 +1,160 @@
+/// End to end latency tracing (WITH_TRACE, on every node)
+///
+/// A traced payload carries a tag after its value : "1#<origin>.<sequence>.<sender>.<tx millis>"
+/// - origin, sequence : the input node (unique id) and its event number, kept end to end
+/// - sender, tx millis : the last hop, and its clock when it published
+/// The tag is removed before the payload is handled, so the rest of the code only sees "1".
+///
+/// The clocks are not synchronized : per sender, the clock offset is estimated as the minimum of
+/// (rx - tx) over a sliding window. A hop latency is therefore relative to the fastest hop seen.
+class Trace {
+  static const byte MAX_PEERS = 8;
+  /// Offset estimation window (the minimum is kept over one to two windows : follows the drift)
+  static const unsigned long WINDOW_MS = 300000;
+
+  struct Peer {
+    byte node;
+    /// last sequence received from this origin (0 : none)
+    word sequence;
+    /// minimum of (rx - tx), current and previous window
+    long offsetMin;
+    long offsetPrevious;
+    unsigned long windowMillis;
+  };
+  static Peer _peers[MAX_PEERS];
+  static byte _peerCount;
+
+public:
+  /// Context of the message being handled
+  static bool active;
+  static byte origin;
+  static word sequence;
+  static byte sender;
+  static unsigned long tx;
+  static unsigned long rx;
+  /// Own events sequence (input node)
+  static word ownSequence;
+  /// Events lost (gaps in the sequences of the origins), since boot
+  static unsigned int lost;
+  /// Latency histogram of the reported events : < 2, 4, 8 ... 128 ms, and above
+  static const byte BUCKETS = 8;
+  static unsigned int histogram[BUCKETS];
+
+  /// Count a latency in the histogram
+  static void record(unsigned long ms)
+  {
+    byte b = 0;
+    while (b < BUCKETS - 1 && ms >= (2UL << b))
+      b++;
+    histogram[b]++;
+  }
+
+  /// Remove the tag from a payload, and keep its context (active if tagged)
+  /// nb: a payload is only cut on a valid tag, an untagged one with a '#' is left as is
+  static void receive(const byte * payload, unsigned int & length)
+  {
+    active = false;
+    const byte * tag = (const byte *)memchr(payload, '#', length);
+    if (tag == NULL)
+      return;
+    unsigned int tagLength = length - (tag + 1 - payload);
+
+    unsigned long fields[4];
+    byte n = 0;
+    byte digits = 0;
+    fields[0] = 0;
+    for (unsigned int i = 0; i < tagLength; i++)
+    {
+      if (tag[1 + i] == '.' && n < 3 && digits > 0)
+      {
+        fields[++n] = 0;
+        digits = 0;
+      }
+      else if (tag[1 + i] >= '0' && tag[1 + i] <= '9')
+      {
+        fields[n] = fields[n] * 10 + (tag[1 + i] - '0');
+        digits++;
+      }
+      else
+        return;
+    }
+    if (n != 3 || digits == 0)
+      return;
+    length = tag - payload;
+    origin = fields[0];
+    sequence = fields[1];
+    sender = fields[2];
+    tx = fields[3];
+    rx = millis();
+    active = true;
+  }
+
+  /// Payload with a tag : propagates the current context, or starts a new one from this node
+  static void tag(char * buffer, size_t size, const char * payload, byte self)
+  {
+    if (!active)
+    {
+      origin = self;
+      sequence = ++ownSequence;
+    }
+    snprintf(buffer, size, "%s#%u.%u.%u.%lu", payload, origin, sequence, self, millis());
+  }
+
+  /// Hop latency of the current message (ms above the fastest seen), updates the offset of its sender
+  static long hop()
+  {
+    Peer * p = peer(sender);
+    if (p == NULL)
+      return 0;
+    long offset = (long)(rx - tx);
+    if (rx - p->windowMillis > WINDOW_MS)
+    {
+      p->windowMillis = rx;
+      p->offsetPrevious = p->offsetMin;
+      p->offsetMin = offset;
+    }
+    p->offsetMin = min(p->offsetMin, offset);
+    return offset - min(p->offsetMin, p->offsetPrevious);
+  }
+
+  /// Count the gaps in the sequence of the current origin (only where all its events are received)
+  static void checkSequence()
+  {
+    Peer * p = peer(origin);
+    if (p == NULL)
+      return;
+    word gap = sequence - p->sequence;
+    // nb: 1 is the first event of a (re)started node
+    if (p->sequence != 0 && sequence != 1 && gap > 1 && gap < 1000)
+      lost += gap - 1;
+    p->sequence = sequence;
+  }
+
+private:
+  static Peer * peer(byte node)
+  {
+    for (byte i = 0; i < _peerCount; i++)
+      if (_peers[i].node == node)
+        return &_peers[i];
+    if (_peerCount == MAX_PEERS)
+      return NULL;
+    Peer * p = &_peers[_peerCount++];
+    p->node = node;
+    p->sequence = 0;
+    p->offsetMin = p->offsetPrevious = (long)(rx - tx);
+    p->windowMillis = rx;
+    return p;
+  }
+};
+
+Trace::Peer Trace::_peers[Trace::MAX_PEERS];
+byte Trace::_peerCount = 0;
+bool Trace::active = false;
+byte Trace::origin = 0;
+word Trace::sequence = 0;
+byte Trace::sender = 0;
+unsigned long Trace::tx = 0;
+unsigned long Trace::rx = 0;
+word Trace::ownSequence = 0;
+unsigned int Trace::lost = 0;
+unsigned int Trace::histogram[Trace::BUCKETS];
@@ -0,0 +1,193 @@
+/// Arduino core stand-in for the host harness (see HOST HARNESS in README.md)
+///
+/// Only what the sketch uses : the time follows the host monotonic clock, the pins are routed to the
+/// simulated board of the node (host/node.cpp), Serial goes to the standard output (the node log).
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+typedef uint8_t byte;
+typedef uint16_t word;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+// Nano pin numbers
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A6 20
+#define A7 21
+
+// ATmega328P memory map (MemoryWatch.h)
+#define RAMEND 0x8FF
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(x,l,h) ((x)<(l)?(l):((x)>(h)?(h):(x)))
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+
+#define noInterrupts()
+#define interrupts()
+
+// AVR timers and ports of the interrupt engines (PulseSampler.h) : plain variables, no interrupt on the host
+#define F_CPU 16000000UL
+#define _BV(b) (1 << (b))
+#define ISR(vector) void vector()
+#define WGM21 1
+#define CS21 1
+#define CS22 2
+#define OCIE2A 1
+inline volatile uint8_t & host_register(int r) { static volatile uint8_t registers[8]; return registers[r]; }
+#define TCCR2A host_register(0)
+#define TCCR2B host_register(1)
+#define OCR2A host_register(2)
+#define TCNT2 host_register(3)
+#define TIMSK2 host_register(4)
+#define digitalPinToPort(pin) (5)
+#define digitalPinToBitMask(pin) ((uint8_t)(1 << ((pin) & 7)))
+#define portOutputRegister(port) (&host_register(port))
+#define portInputRegister(port) (&host_register(port))
+
+// Time : host monotonic clock, since the start of the node
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Pins : simulated board of the node
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+/// As the Arduino core : one data write and one clock pulse per bit
+inline void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val)
+{
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    digitalWrite(dataPin, bitOrder == LSBFIRST ? (val >> i) & 1 : (val >> (7 - i)) & 1);
+    digitalWrite(clockPin, HIGH);
+    digitalWrite(clockPin, LOW);
+  }
+}
+
+class Print;
+
+/// Objects printed by Print (IPAddress)
+class Printable
+{
+public:
+  virtual size_t printTo(Print & p) const = 0;
+};
+
+/// Text output
+class Print
+{
+public:
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t * buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size--)
+      n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char * s) { return write((const uint8_t *)s, strlen(s)); }
+  virtual void flush() {}
+
+  size_t print(const char * s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(long v, int base = DEC)
+  {
+    if (base == DEC && v < 0)
+      return print('-') + print((unsigned long)-v, base);
+    return print((unsigned long)v, base);
+  }
+  size_t print(unsigned long v, int base = DEC)
+  {
+    char buffer[8 * sizeof(long) + 1];
+    char * p = buffer + sizeof(buffer) - 1;
+    *p = 0;
+    do {
+      byte digit = v % base;
+      *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+      v /= base;
+    } while (v != 0);
+    return write(p);
+  }
+  size_t print(double v, int digits = 2)
+  {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, v);
+    return write(buffer);
+  }
+  size_t print(const Printable & x) { return x.printTo(*this); }
+
+  size_t println() { return write("\r\n"); }
+  template<class T> size_t println(T v) { size_t n = print(v); return n + println(); }
+  template<class T> size_t println(T v, int base) { size_t n = print(v, base); return n + println(); }
+};
+
+/// Input and output
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+/// Serial line : the node log (standard output), reads the standard input (replay traces)
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long) {}
+  operator bool() { return true; }
+  virtual size_t write(uint8_t b) { return b == '\r' || fputc(b, stdout) != EOF ? 1 : 0; }
+  virtual size_t write(const uint8_t * buffer, size_t size)
+  {
+    size_t n = 0;
+    for (; n < size; n++)
+      if (!write(buffer[n]))
+        break;
+    return n;
+  }
+  using Print::write;
+  virtual int available()
+  {
+    int n = 0;
+    return ioctl(0, FIONREAD, &n) < 0 ? 0 : n;
+  }
+  virtual int read()
+  {
+    uint8_t c;
+    return available() > 0 && ::read(0, &c, 1) == 1 ? c : -1;
+  }
+  virtual int peek() { return -1; }
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,41 @@
+/// Network client stand-in for the host harness
+#pragma once
+#include "Arduino.h"
+
+/// IPv4 address
+class IPAddress : public Printable
+{
+  uint8_t _address[4];
+
+public:
+  IPAddress() { memset(_address, 0, sizeof(_address)); }
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { _address[0] = a; _address[1] = b; _address[2] = c; _address[3] = d; }
+  IPAddress(const uint8_t * address) { memcpy(_address, address, sizeof(_address)); }
+  uint8_t operator[](int index) const { return _address[index]; }
+
+  virtual size_t printTo(Print & p) const
+  {
+    size_t n = 0;
+    for (int i = 0; i < 4; i++)
+      n += (i ? p.print('.') : 0) + p.print(_address[i], DEC);
+    return n;
+  }
+};
+
+/// As the Arduino Client interface
+class Client : public Stream
+{
+public:
+  virtual int connect(IPAddress ip, uint16_t port) = 0;
+  virtual int connect(const char * host, uint16_t port) = 0;
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t * buffer, size_t size) = 0;
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int read(uint8_t * buffer, size_t size) = 0;
+  virtual int peek() = 0;
+  virtual void flush() = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+  virtual operator bool() = 0;
+};
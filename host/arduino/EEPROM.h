@@ -0,0 +1,19 @@
+/// EEPROM stand-in for the host harness : in memory, blank (0xFF) at each start of the node
+#pragma once
+#include "Arduino.h"
+
+class EEPROMClass
+{
+  uint8_t _memory[1024];
+
+public:
+  EEPROMClass() { memset(_memory, 0xFF, sizeof(_memory)); }
+  uint8_t read(int address) { return _memory[address]; }
+  void write(int address, uint8_t value) { _memory[address] = value; }
+  void update(int address, uint8_t value) { _memory[address] = value; }
+  template<class T> T & get(int address, T & t) { memcpy(&t, _memory + address, sizeof(T)); return t; }
+  template<class T> const T & put(int address, const T & t) { memcpy(_memory + address, &t, sizeof(T)); return t; }
+  uint16_t length() { return sizeof(_memory); }
+};
+
+static EEPROMClass EEPROM;
@@ -0,0 +1,127 @@
+/// Ethernet stand-in for the host harness : the W5x00 sockets are host TCP sockets
+///
+/// Every connection goes to the broker of the harness, 127.0.0.1:$HOST_BROKER_PORT, whatever the
+/// address configured in the sketch.
+#pragma once
+#include "Client.h"
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+enum EthernetHardwareStatus { EthernetNoHardware, EthernetW5100, EthernetW5200, EthernetW5500 };
+enum EthernetLinkStatus { Unknown, LinkON, LinkOFF };
+
+class EthernetClass
+{
+  uint8_t _mac[6];
+  IPAddress _ip;
+
+public:
+  EthernetClass() { memset(_mac, 0, sizeof(_mac)); }
+  void begin(uint8_t * mac, IPAddress ip, IPAddress dns, IPAddress gateway, IPAddress subnet) { memcpy(_mac, mac, sizeof(_mac)); _ip = ip; }
+  void MACAddress(uint8_t * mac) { memcpy(mac, _mac, sizeof(_mac)); }
+  IPAddress localIP() { return _ip; }
+  EthernetHardwareStatus hardwareStatus() { return EthernetW5500; }
+  EthernetLinkStatus linkStatus() { return LinkON; }
+};
+
+extern EthernetClass Ethernet;
+
+class EthernetClient : public Client
+{
+  int _fd;
+
+public:
+  EthernetClient() : _fd(-1) {}
+
+  virtual int connect(IPAddress ip, uint16_t port) { return connect((const char *)NULL, port); }
+  virtual int connect(const char * host, uint16_t port)
+  {
+    stop();
+    const char * brokerPort = getenv("HOST_BROKER_PORT");
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(brokerPort ? atoi(brokerPort) : port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_fd < 0)
+      return 0;
+    if (::connect(_fd, (sockaddr *)&address, sizeof(address)) < 0)
+    {
+      stop();
+      return 0;
+    }
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 1;
+  }
+
+  using Print::write;
+  virtual size_t write(uint8_t b) { return write(&b, 1); }
+  virtual size_t write(const uint8_t * buffer, size_t size)
+  {
+    size_t sent = 0;
+    while (_fd >= 0 && sent < size)
+    {
+      ssize_t n = send(_fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      sent += n;
+    }
+    return sent;
+  }
+
+  virtual int available()
+  {
+    int n = 0;
+    if (_fd < 0 || ioctl(_fd, FIONREAD, &n) < 0)
+      return 0;
+    return n;
+  }
+  virtual int read()
+  {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+  virtual int read(uint8_t * buffer, size_t size)
+  {
+    // nb: as the W5x00, never waits for the data
+    if (available() <= 0)
+      return -1;
+    ssize_t n = recv(_fd, buffer, size, MSG_DONTWAIT);
+    return n > 0 ? (int)n : -1;
+  }
+  virtual int peek()
+  {
+    uint8_t b;
+    if (available() <= 0 || recv(_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) != 1)
+      return -1;
+    return b;
+  }
+  virtual void flush() {}
+  virtual void stop()
+  {
+    if (_fd >= 0)
+      close(_fd);
+    _fd = -1;
+  }
+  /// Open, or closed by the broker with some data left to read
+  virtual uint8_t connected()
+  {
+    if (_fd < 0)
+      return 0;
+    if (available() > 0)
+      return 1;
+    uint8_t b;
+    ssize_t n = recv(_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+  virtual operator bool() { return _fd >= 0; }
+};
@@ -0,0 +1,293 @@
+/// PubSubClient stand-in for the host harness : MQTT 3.1.1, QoS 0, as PubSubClient 2.8 behaves
+///
+/// Same buffer discipline as the library : one packet buffer of MQTT_MAX_PACKET_SIZE bytes, the topic
+/// and payload given to the callback point into it (a publish from the callback overwrites them),
+/// one incoming packet handled per loop(), blocking reads of a packet once its first byte is there.
+#pragma once
+#include "Client.h"
+
+#ifndef MQTT_MAX_PACKET_SIZE
+#define MQTT_MAX_PACKET_SIZE 256
+#endif
+#ifndef MQTT_KEEPALIVE
+#define MQTT_KEEPALIVE 15
+#endif
+#ifndef MQTT_SOCKET_TIMEOUT
+#define MQTT_SOCKET_TIMEOUT 15
+#endif
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+
+#define MQTTCONNECT     1 << 4
+#define MQTTCONNACK     2 << 4
+#define MQTTPUBLISH     3 << 4
+#define MQTTSUBSCRIBE   8 << 4
+#define MQTTSUBACK      9 << 4
+#define MQTTPINGREQ     12 << 4
+#define MQTTPINGRESP    13 << 4
+#define MQTTDISCONNECT  14 << 4
+#define MQTTQOS1        (1 << 1)
+
+/// Fixed header room : type byte and up to 4 bytes of remaining length
+#define MQTT_MAX_HEADER_SIZE 5
+
+#define MQTT_CALLBACK_SIGNATURE void (*callback)(char *, uint8_t *, unsigned int)
+
+class PubSubClient
+{
+  Client * _client;
+  uint8_t buffer[MQTT_MAX_PACKET_SIZE];
+  uint16_t nextMsgId;
+  unsigned long lastOutActivity;
+  unsigned long lastInActivity;
+  bool pingOutstanding;
+  MQTT_CALLBACK_SIGNATURE;
+  IPAddress ip;
+  uint16_t port;
+  int _state;
+
+public:
+  PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client & client)
+  : _client(&client), nextMsgId(1), lastOutActivity(0), lastInActivity(0), pingOutstanding(false), callback(callback), ip(addr), port(port), _state(MQTT_DISCONNECTED) {}
+  PubSubClient(uint8_t * addr, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client & client)
+  : PubSubClient(IPAddress(addr), port, callback, client) {}
+
+  int state() { return _state; }
+
+  bool connect(const char * id, const char * user, const char * pass, const char * willTopic, uint8_t willQos, bool willRetain, const char * willMessage)
+  {
+    if (connected())
+      return true;
+    if (_client->connect(ip, port) != 1)
+    {
+      _state = MQTT_CONNECT_FAILED;
+      return false;
+    }
+    nextMsgId = 1;
+    uint16_t length = MQTT_MAX_HEADER_SIZE;
+    const uint8_t protocol[7] = { 0x00, 0x04, 'M', 'Q', 'T', 'T', 4 };
+    memcpy(buffer + length, protocol, sizeof(protocol));
+    length += sizeof(protocol);
+
+    // clean session, will, credentials
+    uint8_t flags = 0x02;
+    if (willTopic)
+      flags |= 0x04 | (willQos << 3) | (willRetain << 5);
+    if (user)
+      flags |= 0x80 | (pass ? 0x40 : 0);
+    buffer[length++] = flags;
+    buffer[length++] = MQTT_KEEPALIVE >> 8;
+    buffer[length++] = MQTT_KEEPALIVE & 0xFF;
+    length = writeString(id, length);
+    if (willTopic)
+    {
+      length = writeString(willTopic, length);
+      length = writeString(willMessage, length);
+    }
+    if (user)
+    {
+      length = writeString(user, length);
+      if (pass)
+        length = writeString(pass, length);
+    }
+    write(MQTTCONNECT, length - MQTT_MAX_HEADER_SIZE);
+
+    lastInActivity = lastOutActivity = millis();
+    while (!_client->available())
+    {
+      if (millis() - lastInActivity >= MQTT_SOCKET_TIMEOUT * 1000UL)
+      {
+        _state = MQTT_CONNECTION_TIMEOUT;
+        _client->stop();
+        return false;
+      }
+    }
+    uint8_t llen;
+    uint16_t len = readPacket(&llen);
+    if (len == 4 && (buffer[0] & 0xF0) == MQTTCONNACK)
+    {
+      if (buffer[3] == 0)
+      {
+        lastInActivity = millis();
+        pingOutstanding = false;
+        _state = MQTT_CONNECTED;
+        return true;
+      }
+      _state = buffer[3];
+    }
+    _client->stop();
+    return false;
+  }
+
+  bool connected()
+  {
+    if (!_client->connected())
+    {
+      if (_state == MQTT_CONNECTED)
+      {
+        _state = MQTT_CONNECTION_LOST;
+        _client->flush();
+        _client->stop();
+      }
+      return false;
+    }
+    return _state == MQTT_CONNECTED;
+  }
+
+  bool publish(const char * topic, const char * payload, bool retained = false)
+  {
+    return publish(topic, (const uint8_t *)payload, payload ? strlen(payload) : 0, retained);
+  }
+  bool publish(const char * topic, const uint8_t * payload, unsigned int plength, bool retained)
+  {
+    if (!connected() || MQTT_MAX_PACKET_SIZE < MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + plength)
+      return false;
+    uint16_t length = writeString(topic, MQTT_MAX_HEADER_SIZE);
+    memcpy(buffer + length, payload, plength);
+    length += plength;
+    return write(MQTTPUBLISH | (retained ? 1 : 0), length - MQTT_MAX_HEADER_SIZE);
+  }
+
+  bool subscribe(const char * topic)
+  {
+    if (!connected() || MQTT_MAX_PACKET_SIZE < 9 + strlen(topic))
+      return false;
+    uint16_t length = MQTT_MAX_HEADER_SIZE;
+    if (++nextMsgId == 0)
+      nextMsgId = 1;
+    buffer[length++] = nextMsgId >> 8;
+    buffer[length++] = nextMsgId & 0xFF;
+    length = writeString(topic, length);
+    buffer[length++] = 0;
+    return write(MQTTSUBSCRIBE | MQTTQOS1, length - MQTT_MAX_HEADER_SIZE);
+  }
+
+  /// Keep alive, and at most one incoming packet
+  bool loop()
+  {
+    if (!connected())
+      return false;
+    unsigned long t = millis();
+    if (t - lastInActivity > MQTT_KEEPALIVE * 1000UL || t - lastOutActivity > MQTT_KEEPALIVE * 1000UL)
+    {
+      if (pingOutstanding)
+      {
+        _state = MQTT_CONNECTION_TIMEOUT;
+        _client->stop();
+        return false;
+      }
+      buffer[0] = MQTTPINGREQ;
+      buffer[1] = 0;
+      _client->write(buffer, 2);
+      lastOutActivity = lastInActivity = t;
+      pingOutstanding = true;
+    }
+    if (!_client->available())
+      return true;
+
+    uint8_t llen;
+    uint16_t len = readPacket(&llen);
+    if (len == 0)
+      return connected();
+    lastInActivity = t;
+    uint8_t type = buffer[0] & 0xF0;
+    if (type == MQTTPUBLISH && callback)
+    {
+      // the topic is moved one byte down, and zero terminated in place
+      uint16_t tl = (buffer[llen + 1] << 8) + buffer[llen + 2];
+      memmove(buffer + llen + 2, buffer + llen + 3, tl);
+      buffer[llen + 2 + tl] = 0;
+      char * topic = (char *)buffer + llen + 2;
+      callback(topic, buffer + llen + 3 + tl, len - llen - 3 - tl);
+    }
+    else if (type == MQTTPINGREQ)
+    {
+      buffer[0] = MQTTPINGRESP;
+      buffer[1] = 0;
+      _client->write(buffer, 2);
+    }
+    else if (type == MQTTPINGRESP)
+      pingOutstanding = false;
+    return true;
+  }
+
+private:
+  /// Wait for a byte, up to the socket timeout
+  bool readByte(uint8_t * result)
+  {
+    unsigned long start = millis();
+    while (!_client->available())
+      if (millis() - start >= MQTT_SOCKET_TIMEOUT * 1000UL)
+        return false;
+    *result = _client->read();
+    return true;
+  }
+
+  /// Read a whole packet in the buffer, @return its length (0 : timeout, or too large and dropped)
+  uint16_t readPacket(uint8_t * lengthLength)
+  {
+    uint16_t len = 0;
+    if (!readByte(buffer + len++))
+      return 0;
+    uint32_t length = 0;
+    uint32_t multiplier = 1;
+    uint8_t digit;
+    do {
+      if (len == MQTT_MAX_HEADER_SIZE)
+      {
+        _state = MQTT_DISCONNECTED;
+        _client->stop();
+        return 0;
+      }
+      if (!readByte(&digit))
+        return 0;
+      buffer[len++] = digit;
+      length += (digit & 127) * multiplier;
+      multiplier <<= 7;
+    } while (digit & 128);
+    *lengthLength = len - 1;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+      if (!readByte(&digit))
+        return 0;
+      if (len < MQTT_MAX_PACKET_SIZE)
+        buffer[len] = digit;
+      len++;
+    }
+    return len <= MQTT_MAX_PACKET_SIZE ? len : 0;
+  }
+
+  /// Remaining length before the packet, and one write to the client
+  bool write(uint8_t header, uint16_t length)
+  {
+    uint8_t lenBuf[4];
+    uint8_t llen = 0;
+    uint16_t remaining = length;
+    do {
+      uint8_t digit = remaining & 127;
+      remaining >>= 7;
+      lenBuf[llen++] = remaining ? digit | 0x80 : digit;
+    } while (remaining > 0);
+
+    uint8_t * start = buffer + MQTT_MAX_HEADER_SIZE - 1 - llen;
+    start[0] = header;
+    memcpy(start + 1, lenBuf, llen);
+    size_t rc = _client->write(start, length + 1 + llen);
+    lastOutActivity = millis();
+    return rc == 1U + llen + length;
+  }
+
+  uint16_t writeString(const char * string, uint16_t pos)
+  {
+    uint16_t length = strlen(string);
+    buffer[pos++] = length >> 8;
+    buffer[pos++] = length & 0xFF;
+    memcpy(buffer + pos, string, length);
+    return pos + length;
+  }
+};
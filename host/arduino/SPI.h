@@ -0,0 +1,3 @@
+/// SPI stand-in for the host harness : the W5x00 is replaced by a host socket (Ethernet.h)
+#pragma once
+#include "Arduino.h"
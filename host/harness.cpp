@@ -0,0 +1,1239 @@
+/// Host harness : the INPUT, CORE and OUTPUT node builds of the sketch run as processes (node.cpp), against a
+/// broker stand-in, with their shift register chains simulated. A scenario presses the inputs and times the
+/// output latches.
+///
+/// usage: harness [-p port] [-l logs directory] [-s seed] <scenario>
+///
+/// Scenario, one command per line ('#' : comment) :
+///   NODE <input|core|output> <number> [chain [opt1]]  start a node (chain, opt1 : DIP switch and jumper of an input node)
+///   WAIT [timeout ms]                        every node connected, the cores synced, the outputs latched
+///   CALIBRATE [hold ms] [quiet ms]           press each input twice : learn the outputs it toggles
+///   PRESSES <count> <period ms> [hold ms]    random presses of the toggling inputs : press to latch latency
+///   BURST <input node> [hold ms]             all the inputs of the node flip at once, then back
+///   RESTART <down ms>                        the broker goes down and up again (retained messages kept), one press while down
+///   REPORT                                   broker counters, latches and last metrics of each node
+/// The failed checks are printed as FAIL lines, and the exit status is 1.
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define ROOT "MDB"
+
+/// Time of a press waiting for its latch, before it is counted as missed
+const int64_t PRESS_TIMEOUT_MS = 2000;
+
+static int64_t now_ns()
+{
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static const int64_t MS = 1000000;
+
+static int failures = 0;
+
+static void fail(const char * format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  printf("FAIL ");
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+  failures++;
+}
+
+static bool starts_with(const std::string & s, const char * prefix)
+{
+  return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// ----------------------------------------------------------------------------
+// Broker : MQTT 3.1.1, QoS 0 (QoS 1 acknowledged), retained messages, wills
+
+/// MQTT topic filter, with '+' and '#'
+static bool topic_match(const std::string & filter, const std::string & topic)
+{
+  size_t f = 0, t = 0;
+  while (f < filter.size())
+  {
+    if (filter[f] == '#')
+      return true;
+    if (filter[f] == '+')
+    {
+      while (t < topic.size() && topic[t] != '/')
+        t++;
+      f++;
+      continue;
+    }
+    if (t == topic.size())
+      return filter.compare(f, std::string::npos, "/#") == 0;
+    if (filter[f] != topic[t])
+      return false;
+    f++;
+    t++;
+  }
+  return t == topic.size();
+}
+
+/// One client connection
+struct Session
+{
+  int fd;
+  std::string in, out;
+  std::string id;
+  bool connected = false;
+  bool closing = false;
+  bool will = false;
+  std::string willTopic, willPayload;
+  bool willRetain = false;
+  std::vector<std::string> filters;
+};
+
+struct Broker
+{
+  /// nb: out of the ephemeral ports, where a node connecting while the broker is down could connect to itself
+  int port = 11883;
+  int listener = -1;
+  std::vector<Session *> sessions;
+  std::map<std::string, std::string> retained;
+  /// Every message published (before its delivery), and every client connected
+  std::function<void(const std::string &, const std::string &, bool)> onPublish;
+  std::function<void(const std::string &)> onConnect;
+  unsigned long connects = 0, published = 0, delivered = 0;
+
+  bool start()
+  {
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listener, (sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 16) < 0
+        || getsockname(listener, (sockaddr *)&address, &length) < 0)
+    {
+      perror("broker");
+      close(listener);
+      listener = -1;
+      return false;
+    }
+    port = ntohs(address.sin_port);
+    return true;
+  }
+
+  /// Down : the listener and every connection closed at once, no will published
+  void stop()
+  {
+    for (Session * s : sessions)
+    {
+      close(s->fd);
+      delete s;
+    }
+    sessions.clear();
+    if (listener >= 0)
+      close(listener);
+    listener = -1;
+  }
+
+  void accept_session()
+  {
+    int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    Session * s = new Session;
+    s->fd = fd;
+    sessions.push_back(s);
+  }
+
+  void send(Session & s, const std::string & packet)
+  {
+    s.out += packet;
+    flush(s);
+  }
+
+  void flush(Session & s)
+  {
+    while (!s.out.empty())
+    {
+      ssize_t n = ::send(s.fd, s.out.data(), s.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (n <= 0)
+      {
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+          s.closing = true;
+        return;
+      }
+      s.out.erase(0, n);
+    }
+  }
+
+  static std::string packet(uint8_t header, const std::string & body)
+  {
+    std::string p(1, (char)header);
+    size_t remaining = body.size();
+    do {
+      uint8_t digit = remaining & 127;
+      remaining >>= 7;
+      p += (char)(remaining ? digit | 0x80 : digit);
+    } while (remaining);
+    return p + body;
+  }
+
+  static std::string string(const std::string & s)
+  {
+    return std::string(1, (char)(s.size() >> 8)) + (char)(s.size() & 0xFF) + s;
+  }
+
+  void send_publish(Session & s, const std::string & topic, const std::string & payload, bool retain)
+  {
+    delivered++;
+    send(s, packet(0x30 | (retain ? 1 : 0), string(topic) + payload));
+  }
+
+  /// Retained store, then each client subscribed (once, whatever its overlapping filters)
+  void route(const std::string & topic, const std::string & payload, bool retain)
+  {
+    published++;
+    if (retain)
+    {
+      if (payload.empty())
+        retained.erase(topic);
+      else
+        retained[topic] = payload;
+    }
+    if (onPublish)
+      onPublish(topic, payload, retain);
+    for (Session * s : sessions)
+      if (s->connected && !s->closing)
+        for (const std::string & filter : s->filters)
+          if (topic_match(filter, topic))
+          {
+            send_publish(*s, topic, payload, false);
+            break;
+          }
+  }
+
+  /// Read a string field, @return false if the packet is too short
+  static bool field(const std::string & body, size_t & pos, std::string & value)
+  {
+    if (pos + 2 > body.size())
+      return false;
+    size_t length = ((uint8_t)body[pos] << 8) | (uint8_t)body[pos + 1];
+    if (pos + 2 + length > body.size())
+      return false;
+    value = body.substr(pos + 2, length);
+    pos += 2 + length;
+    return true;
+  }
+
+  void handle(Session & s, uint8_t header, const std::string & body)
+  {
+    size_t pos = 0;
+    switch (header >> 4)
+    {
+      case 1: // CONNECT
+      {
+        std::string protocol, user, password;
+        if (!field(body, pos, protocol) || pos + 4 > body.size())
+        {
+          s.closing = true;
+          return;
+        }
+        uint8_t flags = body[pos + 1];
+        pos += 4;
+        field(body, pos, s.id);
+        if (flags & 0x04)
+        {
+          s.will = field(body, pos, s.willTopic) && field(body, pos, s.willPayload);
+          s.willRetain = (flags & 0x20) != 0;
+        }
+        s.connected = true;
+        connects++;
+        send(s, std::string("\x20\x02\x00\x00", 4));
+        if (onConnect)
+          onConnect(s.id);
+        break;
+      }
+      case 3: // PUBLISH
+      {
+        std::string topic;
+        if (!field(body, pos, topic))
+          return;
+        int qos = (header >> 1) & 3;
+        if (qos > 0)
+        {
+          if (qos == 1)
+            send(s, packet(0x40, body.substr(pos, 2)));
+          pos += 2;
+        }
+        route(topic, body.substr(std::min(pos, body.size())), header & 1);
+        break;
+      }
+      case 8: // SUBSCRIBE : acknowledged, then the retained messages of the new filters
+      {
+        std::string id = body.substr(0, 2), granted, filter;
+        std::vector<std::string> added;
+        pos = 2;
+        while (field(body, pos, filter) && pos < body.size())
+        {
+          pos++;
+          granted += '\0';
+          added.push_back(filter);
+          if (std::find(s.filters.begin(), s.filters.end(), filter) == s.filters.end())
+            s.filters.push_back(filter);
+        }
+        send(s, packet(0x90, id + granted));
+        for (auto & r : retained)
+          for (const std::string & f : added)
+            if (topic_match(f, r.first))
+            {
+              send_publish(s, r.first, r.second, true);
+              break;
+            }
+        break;
+      }
+      case 12: // PINGREQ
+        send(s, std::string("\xD0\x00", 2));
+        break;
+      case 14: // DISCONNECT
+        s.will = false;
+        s.closing = true;
+        break;
+    }
+  }
+
+  void receive(Session & s)
+  {
+    char data[4096];
+    ssize_t n = recv(s.fd, data, sizeof(data), MSG_DONTWAIT);
+    if (n <= 0)
+    {
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        s.closing = true;
+      return;
+    }
+    s.in.append(data, n);
+    while (s.in.size() >= 2 && !s.closing)
+    {
+      size_t length = 0, p = 1;
+      int shift = 0;
+      bool complete = false;
+      while (p < s.in.size() && p < 5)
+      {
+        uint8_t digit = s.in[p++];
+        length |= (size_t)(digit & 127) << shift;
+        shift += 7;
+        if (!(digit & 128))
+        {
+          complete = true;
+          break;
+        }
+      }
+      if (!complete || s.in.size() < p + length)
+        return;
+      std::string body = s.in.substr(p, length);
+      uint8_t header = s.in[0];
+      s.in.erase(0, p + length);
+      handle(s, header, body);
+    }
+  }
+
+  /// Closed sessions removed, their wills published
+  void reap()
+  {
+    for (size_t i = 0; i < sessions.size();)
+    {
+      Session * s = sessions[i];
+      if (!s->closing)
+      {
+        i++;
+        continue;
+      }
+      sessions.erase(sessions.begin() + i);
+      close(s->fd);
+      if (s->connected && s->will)
+        route(s->willTopic, s->willPayload, s->willRetain);
+      delete s;
+    }
+  }
+};
+
+// ----------------------------------------------------------------------------
+// Nodes
+
+struct Node
+{
+  std::string mode;
+  int number = 0;
+  int chain = 0;
+  int opt1 = 0;
+  pid_t pid = -1;
+  int control = -1;
+  std::string in;
+  /// e.g. IN/0, and its client id ROOT/STATUS/IN/0
+  std::string name;
+  std::string status;
+  bool alive = true;
+
+  /// Input node : inputs of the topology, and their simulated state
+  int inputs = 0;
+  std::vector<char> pressed;
+
+  /// Output node : last latch
+  bool latchedKnown = false;
+  uint32_t latched = 0;
+  unsigned long latches = 0;
+  int64_t lastChange = 0;
+
+  int64_t connectedAt = 0;
+  int64_t readyAt = 0;
+  unsigned long connects = 0;
+  std::string metrics;
+
+  bool is(const char * m) const { return mode == m; }
+
+  void send(const char * format, ...)
+  {
+    char line[64];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (write(control, line, n) != n)
+      alive = false;
+  }
+
+  void press(int index, bool on)
+  {
+    pressed[index] = on;
+    send("I %d %d\n", index, on ? 1 : 0);
+  }
+
+  /// Topic of an input, as the input node publishes it (module naming)
+  std::string input_topic(int index) const
+  {
+    return std::string(ROOT "/IN/") + std::to_string(number + index / 32) + "/" + std::to_string(index % 32);
+  }
+};
+
+/// Outputs toggled by an input : mask per output node
+typedef std::map<Node *, uint32_t> Masks;
+
+/// A press waiting for its latches
+struct Press
+{
+  Node * node;
+  int index;
+  int64_t start;
+  /// mask and expected value, per output node
+  std::map<Node *, std::pair<uint32_t, uint32_t>> expect;
+  std::set<Node *> done;
+  int64_t last = 0;
+};
+
+/// Message counters
+struct Counters
+{
+  unsigned long in = 0, out = 0, status = 0, other = 0, latches = 0;
+};
+
+struct Harness
+{
+  Broker broker;
+  std::vector<Node *> nodes;
+  std::string directory;
+  std::string logs = "logs";
+  std::multimap<int64_t, std::function<void()>> timers;
+  std::mt19937 rng{1};
+
+  Counters counters;
+  /// Last value of each input topic, and when
+  std::map<std::string, std::string> inputValues;
+  int64_t lastInput = 0, lastOutput = 0;
+  /// Pulses running on the output nodes (payload p<ms>), until their end is published
+  std::set<std::string> pulses;
+
+  /// Calibration : the toggling inputs
+  std::vector<std::pair<Node *, int>> toggles;
+  std::map<std::pair<Node *, int>, Masks> masks;
+
+  std::vector<Press> pending;
+  std::vector<double> latencies;
+  /// Latch changes out of the expected ones (RESTART)
+  bool watchGlitches = false;
+  std::map<Node *, uint32_t> glitches;
+  uint32_t glitchAllowed = 0;
+  Node * glitchAllowedNode = NULL;
+
+  Harness()
+  {
+    broker.onPublish = [this](const std::string & topic, const std::string & payload, bool retain) { observe(topic, payload); };
+    broker.onConnect = [this](const std::string & id) {
+      for (Node * n : nodes)
+        if (n->status == id)
+        {
+          n->connectedAt = now_ns();
+          n->connects++;
+        }
+    };
+  }
+
+  Node * find(const std::string & name)
+  {
+    for (Node * n : nodes)
+      if (n->name == name)
+        return n;
+    return NULL;
+  }
+
+  Node * output(int number)
+  {
+    for (Node * n : nodes)
+      if (n->is("output") && n->number == number)
+        return n;
+    return NULL;
+  }
+
+  void observe(const std::string & topic, const std::string & payload)
+  {
+    // nb: without the tag of WITH_TRACE
+    std::string value = payload.substr(0, payload.find('#'));
+    if (starts_with(topic, ROOT "/IN/"))
+    {
+      counters.in++;
+      inputValues[topic] = value;
+      lastInput = now_ns();
+    }
+    else if (starts_with(topic, ROOT "/OUT/"))
+    {
+      counters.out++;
+      lastOutput = now_ns();
+      if (!value.empty() && value[0] == 'p')
+        pulses.insert(topic);
+      else
+        pulses.erase(topic);
+    }
+    else if (starts_with(topic, ROOT "/STATUS/"))
+    {
+      counters.status++;
+      for (Node * n : nodes)
+      {
+        if (topic == n->status + "/ready")
+          n->readyAt = now_ns();
+        if (topic == n->status + "/metrics")
+        {
+          // nb: a long report comes in several messages, each starting with the same up=
+          std::string up = payload.substr(0, payload.find(' '));
+          if (starts_with(n->metrics, up.c_str()))
+            n->metrics += payload.substr(up.size());
+          else
+            n->metrics = payload;
+        }
+      }
+    }
+    else
+      counters.other++;
+  }
+
+  void latch(Node & n, int64_t ns, uint32_t value)
+  {
+    uint32_t changed = n.latchedKnown ? n.latched ^ value : 0;
+    n.latched = value;
+    n.latchedKnown = true;
+    n.latches++;
+    counters.latches++;
+    if (changed)
+      n.lastChange = ns;
+    if (watchGlitches)
+      glitches[&n] |= changed & ~(&n == glitchAllowedNode ? glitchAllowed : 0);
+
+    for (size_t i = 0; i < pending.size();)
+    {
+      Press & p = pending[i];
+      auto e = p.expect.find(&n);
+      if (e != p.expect.end() && (value & e->second.first) == e->second.second)
+      {
+        p.done.insert(&n);
+        p.last = std::max(p.last, ns);
+      }
+      if (p.done.size() == p.expect.size())
+      {
+        latencies.push_back((p.last - p.start) / 1e6);
+        pending.erase(pending.begin() + i);
+      }
+      else
+        i++;
+    }
+  }
+
+  void control(Node & n)
+  {
+    char data[1024];
+    ssize_t r = read(n.control, data, sizeof(data));
+    if (r <= 0)
+    {
+      if (r == 0 || errno != EAGAIN)
+      {
+        n.alive = false;
+        close(n.control);
+        n.control = -1;
+      }
+      return;
+    }
+    n.in.append(data, r);
+    size_t end;
+    while ((end = n.in.find('\n')) != std::string::npos)
+    {
+      unsigned long long ns;
+      unsigned long value;
+      if (sscanf(n.in.c_str(), "L %llu %lx", &ns, &value) == 2)
+        latch(n, ns, value);
+      n.in.erase(0, end + 1);
+    }
+  }
+
+  /// Run the broker, the node channels and the timers until the deadline
+  void pump(int64_t until)
+  {
+    for (;;)
+    {
+      int64_t now = now_ns();
+      while (!timers.empty() && timers.begin()->first <= now)
+      {
+        auto f = timers.begin()->second;
+        timers.erase(timers.begin());
+        f();
+      }
+      if (now >= until)
+        return;
+      int64_t next = until;
+      if (!timers.empty())
+        next = std::min(next, timers.begin()->first);
+
+      std::vector<pollfd> fds;
+      if (broker.listener >= 0)
+        fds.push_back({ broker.listener, POLLIN, 0 });
+      for (Session * s : broker.sessions)
+        fds.push_back({ s->fd, (short)(POLLIN | (s->out.empty() ? 0 : POLLOUT)), 0 });
+      for (Node * n : nodes)
+        if (n->control >= 0)
+          fds.push_back({ n->control, POLLIN, 0 });
+      size_t polledSessions = broker.sessions.size();
+      int timeout = (int)std::max<int64_t>(0, (next - now + MS - 1) / MS);
+      if (poll(fds.data(), fds.size(), timeout) <= 0)
+        continue;
+
+      size_t i = 0;
+      if (broker.listener >= 0 && fds[i++].revents)
+        broker.accept_session();
+      // nb: the accepted session is polled at the next turn
+      std::vector<Session *> polled(broker.sessions.begin(), broker.sessions.begin() + polledSessions);
+      for (Session * s : polled)
+      {
+        short revents = fds[i++].revents;
+        if (revents & POLLOUT)
+          broker.flush(*s);
+        if (revents & (POLLIN | POLLHUP | POLLERR))
+          broker.receive(*s);
+      }
+      broker.reap();
+      for (Node * n : nodes)
+        if (n->control >= 0 && i < fds.size() && fds[i].fd == n->control && fds[i++].revents)
+          control(*n);
+      check_nodes();
+    }
+  }
+
+  void pump_for(int64_t ms) { pump(now_ns() + ms * MS); }
+
+  /// Pump until the condition holds, @return false on timeout
+  bool pump_until(std::function<bool()> condition, int64_t timeout_ms)
+  {
+    int64_t end = now_ns() + timeout_ms * MS;
+    while (!condition())
+    {
+      if (now_ns() >= end)
+        return false;
+      pump(std::min(end, now_ns() + 5 * MS));
+    }
+    return true;
+  }
+
+  void check_nodes()
+  {
+    for (Node * n : nodes)
+    {
+      int status;
+      if (n->pid > 0 && waitpid(n->pid, &status, WNOHANG) == n->pid)
+      {
+        fail("node %s exited (status %d), see %s/%s.log", n->name.c_str(), status, logs.c_str(), log_name(*n).c_str());
+        n->pid = -1;
+        n->alive = false;
+      }
+    }
+  }
+
+  std::string log_name(const Node & n)
+  {
+    std::string name = n.name;
+    std::replace(name.begin(), name.end(), '/', '_');
+    return name;
+  }
+
+  // ----------------------------------------------------------------------------
+  // Commands
+
+  bool start_node(const std::string & mode, int number, int chain, int opt1)
+  {
+    Node * n = new Node;
+    n->mode = mode;
+    n->number = number;
+    n->chain = chain;
+    n->opt1 = opt1;
+    n->name = (mode == "input" ? "IN/" : mode == "core" ? "CORE/" : "OUT/") + std::to_string(number);
+    n->status = ROOT "/STATUS/" + n->name;
+    if (mode == "input")
+    {
+      // as setup_input()
+      n->inputs = chain == 1 ? 64 : chain == 2 ? 96 : chain == 3 ? 128 : opt1 ? 32 : 96;
+      n->pressed.assign(n->inputs, 0);
+    }
+
+    int pair[2];
+    // nb: no other descriptor of the harness inherited by the node, a closed socket must close
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+      return false;
+    mkdir(logs.c_str(), 0755);
+    std::string log = logs + "/" + log_name(*n) + ".log";
+    std::string binary = directory + "/node_" + mode;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      if (pair[1] == 3)
+        fcntl(3, F_SETFD, 0);
+      else
+        dup2(pair[1], 3);
+      int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      dup2(fd, 1);
+      dup2(fd, 2);
+      setenv("HOST_NODE", std::to_string(number).c_str(), 1);
+      setenv("HOST_CHAIN", std::to_string(chain).c_str(), 1);
+      setenv("HOST_OPT1", std::to_string(opt1).c_str(), 1);
+      setenv("HOST_BROKER_PORT", std::to_string(broker.port).c_str(), 1);
+      execl(binary.c_str(), binary.c_str(), (char *)NULL);
+      perror(binary.c_str());
+      _exit(127);
+    }
+    close(pair[1]);
+    fcntl(pair[0], F_SETFL, O_NONBLOCK);
+    n->pid = pid;
+    n->control = pair[0];
+    nodes.push_back(n);
+    printf("node %s started (%s)\n", n->name.c_str(), binary.c_str());
+    return true;
+  }
+
+  bool ready()
+  {
+    for (Node * n : nodes)
+      if (!n->alive || !n->connectedAt || (n->is("core") && !n->readyAt) || (n->is("output") && !n->latchedKnown))
+        return false;
+    return true;
+  }
+
+  bool wait(int64_t timeout_ms)
+  {
+    int64_t start = now_ns();
+    if (!pump_until([this] { return ready(); }, timeout_ms))
+    {
+      fail("WAIT : nodes not ready after %lld ms", (long long)timeout_ms);
+      return false;
+    }
+    printf("nodes ready after %.0f ms\n", (now_ns() - start) / 1e6);
+    // output sync batch, input snapshots
+    pump_for(1000);
+    return true;
+  }
+
+  std::map<Node *, uint32_t> outputs()
+  {
+    std::map<Node *, uint32_t> latched;
+    for (Node * n : nodes)
+      if (n->is("output"))
+        latched[n] = n->latched;
+    return latched;
+  }
+
+  int64_t last_change()
+  {
+    int64_t last = 0;
+    for (Node * n : nodes)
+      last = std::max(last, n->lastChange);
+    return last;
+  }
+
+  /// Press and release, until no output changed for quiet ms : @return the outputs changed, and if anything else than inputs, outputs or status was published
+  Masks press_and_watch(Node & input, int index, int hold, int quiet, bool & other)
+  {
+    std::map<Node *, uint32_t> before = outputs();
+    unsigned long others = counters.other;
+    int64_t start = now_ns();
+    input.press(index, true);
+    pump_for(hold);
+    input.press(index, false);
+    pump_until([&] { return now_ns() - std::max(start + hold * MS, last_change()) >= quiet * MS; }, 2000);
+    other = counters.other != others;
+    Masks changed;
+    for (auto & b : before)
+      if (b.second != b.first->latched)
+        changed[b.first] = b.second ^ b.first->latched;
+    return changed;
+  }
+
+  std::string describe(const Masks & m)
+  {
+    std::string s;
+    for (auto & e : m)
+      for (int bit = 0; bit < 32; bit++)
+        if ((e.second >> bit) & 1)
+          s += std::string(s.empty() ? "" : " ") + ROOT "/OUT/" + std::to_string(e.first->number) + "/" + std::to_string(bit);
+    return s;
+  }
+
+  void calibrate(int hold, int quiet)
+  {
+    toggles.clear();
+    masks.clear();
+    int none = 0, left = 0;
+    int64_t start = now_ns();
+    for (Node * n : nodes)
+      for (int index = 0; n->is("input") && index < n->inputs; index++)
+      {
+        bool other;
+        Masks first = press_and_watch(*n, index, hold, quiet, other);
+        if (first.empty())
+        {
+          none++;
+          continue;
+        }
+        // a toggle : the same outputs back with a second press (which also stops a cover), nothing else published
+        bool other2;
+        Masks second = press_and_watch(*n, index, hold, quiet, other2);
+        if (other || other2 || second != first)
+        {
+          printf("  %s -> %s : left out (%s)\n", n->input_topic(index).c_str(), describe(first).c_str(),
+                 other || other2 ? "other topics published" : "not a toggle");
+          left++;
+          continue;
+        }
+        printf("  %s -> %s\n", n->input_topic(index).c_str(), describe(first).c_str());
+        toggles.push_back({ n, index });
+        masks[{ n, index }] = first;
+      }
+    printf("calibrated in %.1f s : %zu toggling inputs, %d left out, %d without output\n", (now_ns() - start) / 1e9, toggles.size(), left, none);
+    if (toggles.empty())
+      fail("CALIBRATE : no toggling input");
+  }
+
+  bool busy(Node * input, int index)
+  {
+    const Masks & m = masks[{ input, index }];
+    for (Press & p : pending)
+    {
+      if (p.node == input && p.index == index)
+        return true;
+      for (auto & e : m)
+      {
+        auto x = p.expect.find(e.first);
+        if (x != p.expect.end() && (x->second.first & e.second))
+          return true;
+      }
+    }
+    return input->pressed[index];
+  }
+
+  /// Press a toggling input whose outputs are not awaited : @return false if none
+  bool press_random(int hold)
+  {
+    if (toggles.empty())
+      return false;
+    size_t first = rng() % toggles.size();
+    for (size_t k = 0; k < toggles.size(); k++)
+    {
+      auto t = toggles[(first + k) % toggles.size()];
+      if (busy(t.first, t.second))
+        continue;
+      Press p;
+      p.node = t.first;
+      p.index = t.second;
+      for (auto & e : masks[t])
+        p.expect[e.first] = { e.second, (e.first->latched ^ e.second) & e.second };
+      p.start = now_ns();
+      pending.push_back(p);
+      Node * n = t.first;
+      int index = t.second;
+      n->press(index, true);
+      timers.insert({ p.start + hold * MS, [n, index] { n->press(index, false); } });
+      return true;
+    }
+    return false;
+  }
+
+  /// Drop the presses waiting for too long : @return how many
+  int expire()
+  {
+    int missed = 0;
+    for (size_t i = 0; i < pending.size();)
+      if (now_ns() - pending[i].start > PRESS_TIMEOUT_MS * MS)
+      {
+        printf("  missed : %s -> %s\n", pending[i].node->input_topic(pending[i].index).c_str(), describe(masks[{ pending[i].node, pending[i].index }]).c_str());
+        pending.erase(pending.begin() + i);
+        missed++;
+      }
+      else
+        i++;
+    return missed;
+  }
+
+  void report_latencies(std::vector<double> & l)
+  {
+    if (l.empty())
+      return;
+    std::sort(l.begin(), l.end());
+    auto at = [&](double q) { return l[std::min(l.size() - 1, (size_t)(q * l.size()))]; };
+    printf("latency ms : min=%.1f median=%.1f p95=%.1f max=%.1f\n", l.front(), at(0.5), at(0.95), l.back());
+    // as the lat= histogram of the metrics
+    unsigned int histogram[8] = { 0 };
+    for (double v : l)
+    {
+      int b = 0;
+      while (b < 7 && v >= (2 << b))
+        b++;
+      histogram[b]++;
+    }
+    printf("histogram  :");
+    for (int b = 0; b < 7; b++)
+      printf(" <%d:%u", 2 << b, histogram[b]);
+    printf(" >=128:%u\n", histogram[7]);
+  }
+
+  void presses(int count, int period, int hold)
+  {
+    if (toggles.empty())
+    {
+      fail("PRESSES : no toggling input, CALIBRATE first");
+      return;
+    }
+    latencies.clear();
+    pending.clear();
+    Counters before = counters;
+    int issued = 0, missed = 0, skipped = 0;
+    int64_t start = now_ns(), next = start;
+    while (issued < count || !pending.empty())
+    {
+      if (issued < count && now_ns() >= next)
+      {
+        if (press_random(hold))
+          issued++;
+        else
+          skipped++;
+        next += period * MS;
+      }
+      missed += expire();
+      pump(issued < count ? next : now_ns() + 5 * MS);
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    printf("presses=%d done=%zu missed=%d postponed=%d (outputs awaited) in %.1f s\n", issued, latencies.size(), missed, skipped, seconds);
+    printf("messages : in=%lu out=%lu status=%lu latches=%lu\n", counters.in - before.in, counters.out - before.out,
+           counters.status - before.status, counters.latches - before.latches);
+    report_latencies(latencies);
+    if (missed)
+      fail("PRESSES : %d presses without their latch after %lld ms", missed, (long long)PRESS_TIMEOUT_MS);
+  }
+
+  /// Until no input, output or latch for quiet ms, and no pulse running
+  void settle(int quiet, int timeout)
+  {
+    pump_until([&] {
+      int64_t last = std::max(std::max(lastInput, lastOutput), last_change());
+      return pulses.empty() && now_ns() - last >= quiet * MS;
+    }, timeout);
+  }
+
+  /// Every output latched as its retained value
+  void check_outputs(const char * step)
+  {
+    for (Node * n : nodes)
+    {
+      if (!n->is("output"))
+        continue;
+      uint32_t known = 0, retained = 0;
+      for (int bit = 0; bit < 32; bit++)
+      {
+        auto r = broker.retained.find(ROOT "/OUT/" + std::to_string(n->number) + "/" + std::to_string(bit));
+        if (r == broker.retained.end() || r->second.empty() || r->second[0] == 'p')
+          continue;
+        known |= 1UL << bit;
+        if (atoi(r->second.c_str()) != 0)
+          retained |= 1UL << bit;
+      }
+      if ((n->latched & known) != retained)
+        fail("%s : %s latched %08x, retained %08x (outputs %08x)", step, n->name.c_str(), n->latched & known, retained, (n->latched & known) ^ retained);
+      else
+        printf("%s latched as retained (%d outputs)\n", n->name.c_str(), __builtin_popcount(known));
+    }
+  }
+
+  void burst(Node * input, int hold)
+  {
+    if (!input || !input->is("input"))
+    {
+      fail("BURST : no such input node");
+      return;
+    }
+    Counters before = counters;
+    for (auto & v : inputValues)
+      v.second.clear();
+    int64_t start = now_ns();
+    for (int index = 0; index < input->inputs; index++)
+      input->press(index, !input->pressed[index]);
+    pump_for(hold);
+    int64_t firstLast = lastInput, back = now_ns();
+    unsigned long firstCount = counters.in - before.in;
+    for (int index = 0; index < input->inputs; index++)
+      input->press(index, !input->pressed[index]);
+    settle(1000, 60000);
+
+    int silent = 0, mismatch = 0;
+    for (int index = 0; index < input->inputs; index++)
+    {
+      auto v = inputValues.find(input->input_topic(index));
+      if (v == inputValues.end() || v->second.empty())
+        silent++;
+      else if ((atoi(v->second.c_str()) != 0) != (bool)input->pressed[index])
+        mismatch++;
+    }
+    printf("%d inputs flipped for %d ms, and back\n", input->inputs, hold);
+    printf("in=%lu (expected %d) : %lu in %.1f ms, the rest in %.1f ms after the flip back\n", counters.in - before.in, 2 * input->inputs,
+           firstCount, firstLast > start ? (firstLast - start) / 1e6 : 0.0, lastInput > back ? (lastInput - back) / 1e6 : 0.0);
+    printf("out=%lu latches=%lu, last output change %.1f ms after the flip back\n", counters.out - before.out, counters.latches - before.latches,
+           last_change() > back ? (last_change() - back) / 1e6 : 0.0);
+    if (silent || mismatch)
+      fail("BURST : %d inputs never published, %d published with a wrong last value", silent, mismatch);
+    check_outputs("BURST");
+  }
+
+  void restart(int down)
+  {
+    std::map<Node *, uint32_t> before = outputs();
+    glitches.clear();
+    glitchAllowed = 0;
+    glitchAllowedNode = NULL;
+    watchGlitches = true;
+
+    broker.stop();
+    int64_t stopped = now_ns();
+    printf("broker down for %d ms\n", down);
+
+    // one press while the broker is down
+    std::pair<Node *, int> pressedDown(NULL, 0);
+    Masks expected;
+    if (!toggles.empty())
+    {
+      pump_for(down / 2);
+      pressedDown = toggles[rng() % toggles.size()];
+      expected = masks[pressedDown];
+      if (expected.size() == 1)
+      {
+        glitchAllowedNode = expected.begin()->first;
+        glitchAllowed = expected.begin()->second;
+      }
+      pressedDown.first->press(pressedDown.second, true);
+      pump_for(100);
+      pressedDown.first->press(pressedDown.second, false);
+    }
+    pump(stopped + down * MS);
+
+    if (!broker.start())
+    {
+      fail("RESTART : broker not started again");
+      return;
+    }
+    int64_t up = now_ns();
+    for (Node * n : nodes)
+      n->connectedAt = n->readyAt = 0;
+    if (!pump_until([this] { return ready(); }, 30000))
+      fail("RESTART : nodes not back after 30 s");
+    pump_for(1500);
+    watchGlitches = false;
+
+    for (Node * n : nodes)
+    {
+      printf("%s reconnected in %.0f ms", n->name.c_str(), n->connectedAt ? (n->connectedAt - up) / 1e6 : -1.0);
+      if (n->is("core"))
+        printf(", synced in %.0f ms", n->readyAt ? (n->readyAt - up) / 1e6 : -1.0);
+      if (n->is("output"))
+        printf(", %u outputs changed", __builtin_popcount(glitches[n]));
+      printf("\n");
+    }
+    for (auto & g : glitches)
+      if (g.second)
+        fail("RESTART : %s outputs %08x changed by the restart", g.first->name.c_str(), g.second);
+    if (pressedDown.first)
+    {
+      bool applied = true;
+      for (auto & e : expected)
+        applied = applied && ((before[e.first] ^ e.first->latched) & e.second) == e.second;
+      printf("press of %s while down : %s\n", pressedDown.first->input_topic(pressedDown.second).c_str(),
+             applied ? "applied after the reconnect" : "lost (released before the reconnect)");
+    }
+    check_outputs("RESTART");
+  }
+
+  void report()
+  {
+    printf("broker : connects=%lu published=%lu delivered=%lu retained=%zu\n", broker.connects, broker.published, broker.delivered, broker.retained.size());
+    printf("messages : in=%lu out=%lu status=%lu other=%lu latches=%lu\n", counters.in, counters.out, counters.status, counters.other, counters.latches);
+    for (Node * n : nodes)
+    {
+      printf("%s : connects=%lu", n->name.c_str(), n->connects);
+      if (n->is("output"))
+        printf(" latches=%lu outputs=%08x", n->latches, n->latched);
+      printf("\n  %s\n", n->metrics.empty() ? "(no metrics yet)" : n->metrics.c_str());
+    }
+  }
+
+  /// Run a scenario : @return false if it was stopped
+  bool run(FILE * scenario)
+  {
+    char line[256];
+    while (fgets(line, sizeof(line), scenario))
+    {
+      line[strcspn(line, "#\r\n")] = 0;
+      char command[16], word[16];
+      int a = -1, b = -1, c = -1;
+      int fields = sscanf(line, "%15s", command);
+      if (fields < 1)
+        continue;
+      printf("\n== %s\n", line);
+      fflush(stdout);
+      if (!strcmp(command, "NODE") && sscanf(line, "%*s %15s %d %d %d", word, &a, &b, &c) >= 2)
+      {
+        if (!start_node(word, a, b < 0 ? 0 : b, c < 0 ? 0 : c))
+          return false;
+      }
+      else if (!strcmp(command, "WAIT"))
+      {
+        sscanf(line, "%*s %d", &a);
+        if (!wait(a < 0 ? 30000 : a))
+          return false;
+      }
+      else if (!strcmp(command, "CALIBRATE"))
+      {
+        sscanf(line, "%*s %d %d", &a, &b);
+        calibrate(a < 0 ? 80 : a, b < 0 ? 250 : b);
+      }
+      else if (!strcmp(command, "PRESSES") && sscanf(line, "%*s %d %d %d", &a, &b, &c) >= 2)
+        presses(a, b, c < 0 ? 80 : c);
+      else if (!strcmp(command, "BURST") && sscanf(line, "%*s %15s %d", word, &a) >= 1)
+        burst(find(word), a < 0 ? 500 : a);
+      else if (!strcmp(command, "RESTART") && sscanf(line, "%*s %d", &a) == 1)
+        restart(a);
+      else if (!strcmp(command, "REPORT"))
+        report();
+      else
+      {
+        fail("unknown command : %s", line);
+        return false;
+      }
+      fflush(stdout);
+    }
+    return true;
+  }
+
+  void stop()
+  {
+    for (Node * n : nodes)
+    {
+      if (n->control >= 0)
+        close(n->control);
+      if (n->pid > 0)
+      {
+        kill(n->pid, SIGTERM);
+        waitpid(n->pid, NULL, 0);
+      }
+    }
+    broker.stop();
+  }
+};
+
+int main(int argc, char ** argv)
+{
+  Harness harness;
+  int option;
+  while ((option = getopt(argc, argv, "p:l:s:")) != -1)
+  {
+    if (option == 'p')
+      harness.broker.port = atoi(optarg);
+    else if (option == 'l')
+      harness.logs = optarg;
+    else if (option == 's')
+      harness.rng.seed(atoi(optarg));
+    else
+      return 2;
+  }
+  if (optind >= argc)
+  {
+    fprintf(stderr, "usage: %s [-p port] [-l logs directory] [-s seed] <scenario>\n", argv[0]);
+    return 2;
+  }
+  FILE * scenario = fopen(argv[optind], "r");
+  if (!scenario)
+  {
+    perror(argv[optind]);
+    return 2;
+  }
+
+  // the node builds are next to the harness
+  char self[4096];
+  ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  self[n > 0 ? n : 0] = 0;
+  harness.directory = n > 0 ? std::string(self).substr(0, std::string(self).rfind('/')) : ".";
+
+  signal(SIGPIPE, SIG_IGN);
+  if (!harness.broker.start())
+    return 2;
+  printf("broker on 127.0.0.1:%d\n", harness.broker.port);
+  harness.run(scenario);
+  harness.stop();
+  fclose(scenario);
+  printf("\n%s : %d failed checks\n", failures ? "FAILED" : "PASSED", failures);
+  return failures ? 1 : 0;
+}
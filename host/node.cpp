@@ -0,0 +1,281 @@
+/// One node of the host harness : the sketch built for one mode (MODE_INPUT, MODE_CORE or MODE_OUTPUT),
+/// run on a simulated board, its network through the broker of the harness (see harness.cpp)
+///
+/// Environment :
+///   HOST_NODE         node number, read on the DIP switch (A7)
+///   HOST_CHAIN        input chain length, read on the DIP switch (A6)
+///   HOST_OPT1         1 : jumper OPT1 set (input node without slaves)
+///   HOST_BROKER_PORT  broker port on 127.0.0.1
+///   HOST_LOOP_US      pause after each loop(), the time the board would spend in the SPI and pin accesses (default 1000)
+///
+/// Control channel on fd 3, one command per line :
+///   harness -> node  "I <input> <0|1>"  74HC165 input released / pressed, numbered as the events of the sketch
+///   node -> harness  "L <ns> <hex>"     74HC595 latch : CLOCK_MONOTONIC time, the 32 outputs numbered as the sketch
+/// The node ends when the channel is closed.
+///
+/// Built with WITH_REPLAY (CORE) : no control channel, the trace is read on the standard input (Serial)
+/// and the node ends at its end, e.g.  ./node_replay < scenarios/shutter.replay
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if !defined MODE_INPUT && !defined MODE_CORE && !defined MODE_OUTPUT
+#error "The host harness runs MODE_INPUT, MODE_CORE or MODE_OUTPUT nodes."
+#endif
+
+HardwareSerial Serial;
+EthernetClass Ethernet;
+// Memory map of the AVR libc (freeRam(), MemoryWatch.h) : a heap top in the low 4 GB, where an int holds it
+int __heap_start, *__brkval;
+char __data_load_end;
+
+#include "../mqtt-domo-io-arduino.ino"
+
+#ifdef WITH_DIMMER
+#error "The dimmer needs the Timer1 registers, not simulated."
+#endif
+#ifdef WITH_REPLAY
+// the sketch follows the virtual clock of the replay, the node defines the host one
+#undef millis
+#endif
+
+// ----------------------------------------------------------------------------
+// Time
+
+/// Boot time of the node
+timespec board_boot;
+
+unsigned long micros()
+{
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - board_boot.tv_sec) * 1000000L + (now.tv_nsec - board_boot.tv_nsec) / 1000;
+}
+
+unsigned long millis()
+{
+  return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+  timespec t = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000L };
+  while (nanosleep(&t, &t) < 0)
+    ;
+}
+
+/// Busy wait, as the AVR
+void delayMicroseconds(unsigned int us)
+{
+  unsigned long start = micros();
+  while (micros() - start < us)
+    ;
+}
+
+// ----------------------------------------------------------------------------
+// Board
+
+/// DIP switch readings of the node numbers (see setup_compute_dipswitch_number())
+const int board_id_table[] = { 0, 176, 317, 407, 510, 559, 605, 638 };
+
+/// Last level written on each pin
+byte board_pins[32];
+int board_node;
+int board_chain;
+bool board_opt1;
+
+/// Control channel
+const int BOARD_CONTROL_FD = 3;
+char board_line[64];
+int board_line_length = 0;
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (mode == INPUT_PULLUP)
+    board_pins[pin] = HIGH;
+}
+
+int analogRead(uint8_t pin)
+{
+  if (pin == PIN_DIPSWITCH)
+    return board_id_table[board_node & 7];
+  if (pin == PIN_CHAINLENGTH)
+    return board_id_table[board_chain & 7];
+  return 0;
+}
+
+#ifdef MODE_INPUT
+/// 74HC165 chains : inputs as numbered by the sketch, and the bits loaded in each branch (shift order)
+bool board_inputs[SHIFT_INPUT_MAX_BITS];
+bool board_loaded[SHIFT_INPUT_MAX_BRANCHES][SHIFT_INPUT_MAX_BITS];
+byte board_bits;
+byte board_branches;
+/// Clock pulses since the parallel load
+byte board_position;
+
+/// Topology read by setup_input() from the DIP switch and the option jumper
+void board_topology()
+{
+  board_branches = 1;
+  board_bits = board_chain == 1 ? 64 : board_chain == 2 ? 96 : board_chain == 3 ? 128 : 32;
+  if (board_bits == 32 && !board_opt1)
+    board_branches = 3;
+}
+
+/// Input number of a bit, as readInputsInner() numbers it
+int board_input_index(int bit, int branch)
+{
+  int index = bit + branch * board_bits;
+#ifdef HACK_FIX_LAST_TWO_BITS
+  index = (index & ~3) | ((index ^ 3) & 3);
+#endif
+  return index;
+}
+
+void board_input_write(uint8_t pin, uint8_t value)
+{
+  // Parallel load
+  if (pin == PIN_INPUT_PL && value == LOW)
+  {
+    for (byte j = 0; j < board_branches; j++)
+      for (byte i = 0; i < board_bits; i++)
+        board_loaded[j][i] = board_inputs[board_input_index(i, j)];
+    board_position = 0;
+  }
+  // Rising clock, enabled : next bit
+  if (pin == PIN_INPUT_CP && value == HIGH && board_pins[PIN_INPUT_CP] == LOW && board_pins[PIN_INPUT_CE] == LOW && board_position < board_bits)
+    board_position++;
+}
+
+int board_input_read(uint8_t pin)
+{
+  const byte data[] = { PIN_INPUT_DATA0, PIN_INPUT_DATA1, PIN_INPUT_DATA2 };
+  for (byte j = 0; j < board_branches; j++)
+    if (pin == data[j])
+      return board_position < board_bits && board_loaded[j][board_position] ? HIGH : LOW;
+  if (pin == PIN_INPUT_OPTION1)
+    return board_opt1 ? LOW : HIGH;
+  return board_pins[pin];
+}
+#endif
+
+#ifdef MODE_OUTPUT
+/// 74HC595 chain : bits shifted since the latch went low
+unsigned long board_shifted;
+byte board_shifted_count;
+
+void board_output_write(uint8_t pin, uint8_t value)
+{
+  if (pin == PIN_OUTPUT_LATCH && value == LOW)
+  {
+    board_shifted = 0;
+    board_shifted_count = 0;
+  }
+  // Rising clock : one bit, the bytes of ShiftOutput::apply() from the output 24 down to 0, LSB first
+  if (pin == PIN_OUTPUT_CLOCK && value == HIGH && board_pins[PIN_OUTPUT_CLOCK] == LOW)
+  {
+    byte p = board_shifted_count++;
+    if (p < 32 && board_pins[PIN_OUTPUT_DATA])
+      board_shifted |= 1UL << (24 - 8 * (p / 8) + p % 8);
+  }
+  // Rising latch : reported to the harness
+  if (pin == PIN_OUTPUT_LATCH && value == HIGH && board_pins[PIN_OUTPUT_LATCH] == LOW)
+  {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    char line[48];
+    int n = snprintf(line, sizeof(line), "L %llu %08lx\n", now.tv_sec * 1000000000ULL + now.tv_nsec, board_shifted);
+    if (write(BOARD_CONTROL_FD, line, n) != n)
+      exit(0);
+  }
+}
+#endif
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+#ifdef MODE_INPUT
+  board_input_write(pin, value);
+#endif
+#ifdef MODE_OUTPUT
+  board_output_write(pin, value);
+#endif
+  board_pins[pin] = value ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin)
+{
+#ifdef MODE_INPUT
+  return board_input_read(pin);
+#else
+  return board_pins[pin];
+#endif
+}
+
+/// One command of the harness
+void board_command(const char * line)
+{
+  int index, value;
+#ifdef MODE_INPUT
+  if (sscanf(line, "I %d %d", &index, &value) == 2 && index >= 0 && index < board_bits * board_branches)
+  {
+    board_inputs[index] = value != 0;
+    return;
+  }
+#endif
+  Serial.print("Board: unknown command "); Serial.println(line);
+}
+
+/// Commands waiting on the control channel
+void board_poll()
+{
+  pollfd p = { BOARD_CONTROL_FD, POLLIN, 0 };
+  while (poll(&p, 1, 0) > 0)
+  {
+    char c;
+    if (read(BOARD_CONTROL_FD, &c, 1) != 1)
+      exit(0);
+    if (c != '\n' && board_line_length < (int)sizeof(board_line) - 1)
+    {
+      board_line[board_line_length++] = c;
+      continue;
+    }
+    board_line[board_line_length] = 0;
+    board_line_length = 0;
+    board_command(board_line);
+  }
+}
+
+int main()
+{
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  clock_gettime(CLOCK_MONOTONIC, &board_boot);
+  __brkval = (int *)mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+
+  board_node = atoi(getenv("HOST_NODE") ? getenv("HOST_NODE") : "0");
+  board_chain = atoi(getenv("HOST_CHAIN") ? getenv("HOST_CHAIN") : "0");
+  board_opt1 = atoi(getenv("HOST_OPT1") ? getenv("HOST_OPT1") : "0") != 0;
+  unsigned int loop_us = atoi(getenv("HOST_LOOP_US") ? getenv("HOST_LOOP_US") : "1000");
+  board_pins[PIN_INPUT_OPTION2] = HIGH;
+#ifdef MODE_INPUT
+  board_topology();
+#endif
+
+  setup();
+  for (;;)
+  {
+#ifdef WITH_REPLAY
+    // end of the trace : readable, nothing left
+    pollfd p = { 0, POLLIN, 0 };
+    if (poll(&p, 1, 0) > 0 && Serial.available() == 0)
+      exit(0);
+#else
+    board_poll();
+#endif
+    loop();
+    if (loop_us)
+      usleep(loop_us);
+  }
+}
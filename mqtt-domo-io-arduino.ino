@@ -2,13 +2,42 @@
 #include <Ethernet.h>
 #include <PubSubClient.h>
 #include <string.h>
+#include <stdarg.h>
 
 #define HACK_FIX_LAST_TWO_BITS // Hardware V2.1 has wrong inputs order
+//#define WITH_REPLAY            // CORE only: replay a recorded MQTT trace fed on the serial line, no network (see Replay.h)
+//#define WITH_BENCH             // Run the micro benchmarks of the current mode at boot, no network (see Bench.h)
+//#define WITH_TRACE             // All nodes (or none) : tag the events and report the latency of each hop (see Trace.h)
+
+#ifdef WITH_REPLAY
+#include "Replay.h"
+// Virtual clock : every millis() of the sketch follows the trace timestamps
+#define millis() Replay::now()
+#endif
+
+// Bench tools work offline
+#if defined WITH_REPLAY || defined WITH_BENCH
+#define WITHOUT_NETWORK
+#endif
 
 #include "ShiftOutput.h"
 #include "ShiftInput.h"
 #include "Blink.h"
+#include "MemoryWatch.h"
+#include "BufferedClient.h"
+#include "MqttParse.h"
+#include "InputState.h"
+#include "PulseCounter.h"
+#include "TimerWheel.h"
 #include "Cover.h"
+#include "Gesture.h"
+#include "Rules.h"
+#ifdef WITH_BENCH
+#include "Bench.h"
+#endif
+#ifdef WITH_TRACE
+#include "Trace.h"
+#endif
 
 #define RELEASE_VERSION "0.10 - 11/2021"
 
@@ -17,19 +46,25 @@
 // - INPUT: Read informations on chips and publish them to MQTT
 // - OUTPUT: Subscribe to informations on MQTT and write them physically on chips
 // - CORE: Subscribe to informations on MQTT and publish computations on MQTT - print stuff on screen SSD1306
-//
-// - SENSOR: Read sensors and publishes them --- Other project ? ---
+// - TRACE: Subscribe to the status of the nodes and show them on an SSD1306 screen
+// - SENSOR: Read the DS18 temperature sensors (OneWire buses) and publish them to MQTT
 // ----------------------------------------------------------------
 
 //#define MODE_INPUT
 //#define MODE_OUTPUT
 //#define MODE_CORE
+//#define MODE_TRACE
+//#define MODE_SENSOR
 
-#if !defined MODE_INPUT && !defined MODE_OUTPUT && !defined MODE_CORE 
-#warning "Using a default MODE. You can should define MODE_CORE, MODE_INPUT or MODE_OUTPUT."
+#if !defined MODE_INPUT && !defined MODE_OUTPUT && !defined MODE_CORE && !defined MODE_TRACE && !defined MODE_SENSOR
+#warning "Using a default MODE. You can should define MODE_CORE, MODE_INPUT, MODE_OUTPUT, MODE_TRACE or MODE_SENSOR."
 #define MODE_CORE
 #endif
 
+#if defined WITH_REPLAY && !defined MODE_CORE
+#error "WITH_REPLAY is only available for MODE_CORE."
+#endif
+
 // ----------------------------------------------------------------------------
 // SETTINGS TO MODIFY
 
@@ -88,7 +123,8 @@ const int mqtt_broker_port = 1883;
 // Option header OPT2 in INPUT BOARD
 #define PIN_INPUT_OPTION2 9
 
-#define PIN_CORE_ONEWIREPINS 3,4,5
+// The DS18 OneWire buses (SENSOR node, or CORE node WITH_DS18)
+#define PIN_ONEWIREPINS 3,4,5
 
 
 // Output defs
@@ -110,8 +146,10 @@ const int mqtt_broker_port = 1883;
 // ROOT/STATUS/CORE/1
 // ROOT/STATUS/OUT/0
 
-// With temperature sensors
-#define WITH_DS18
+// Gather the MQTT writes of a loop, read by chunks (see BufferedClient.h)
+#define WITH_BUFFERED_CLIENT
+// Time budget per loop for the incoming MQTT messages (handled until none is left, or the budget is spent)
+#define MQTT_DRAIN_BUDGET_US 4000
 
 // Watchdog for nodered logic - If nodered is running our CORE is inactive
 #define MQTT_NODERED_WATCHDOG MQTT_ROOT_TOPIC "/NR/WATCHDOG"
@@ -121,6 +159,18 @@ const int mqtt_broker_port = 1883;
 #define MQTT_ALL_STATUS MQTT_ROOT_TOPIC "/STATUS/#"
 #define MQTT_ALL_NODES_SUFFIX "/#"
 
+// Temperatures : ROOT/SENSOR/<sensor address>
+#define MQTT_SENSORS_PREFIX MQTT_ROOT_TOPIC "/SENSOR/"
+
+// Input snapshots : ROOT/IN/<module>/state = "<sequence> <bits>" (hex), periodically and on request
+#define MQTT_INPUT_STATE_SUFFIX "/state"
+#define MQTT_INPUT_STATE_REQUEST MQTT_ROOT_TOPIC "/IN/get"
+
+// Output pulse timed by the output node : ROOT/OUT/<n>/<output> = "p500" is on for 500 ms (at most 32767),
+// then off and "0" published (retained)
+#define OUTPUT_PULSE_PREFIX 'p'
+#define OUTPUT_PULSE_MAX_MS 32767
+
 // My own prefix
 #ifdef MODE_INPUT
 #define MQTT_SHORT_NAME  "INPUT NODE #%d - UID#%d"
@@ -134,15 +184,41 @@ const int mqtt_broker_port = 1883;
 // Generic I/O publish topic ROOT/TYPE/node_id/io_number  (FMT => %d %d )
 #define MQTT_IO_SUBSCRIBE_TOPIC_COMMON MQTT_ROOT_TOPIC MQTT_SHORT_TOPIC
 #define MQTT_IO_SUBSCRIBE_TOPIC MQTT_IO_SUBSCRIBE_TOPIC_COMMON MQTT_ALL_NODES_SUFFIX
+// Keep the last outputs in EEPROM, latched at boot
+#define WITH_OUTPUT_SNAPSHOT
+  #ifdef WITH_OUTPUT_SNAPSHOT
+  #include "OutputSnapshot.h"
+  #endif
+// Dimmable outputs (0-255 levels) by binary code modulation, from the Timer1 interrupt
+//#define WITH_DIMMER
+  #ifdef WITH_DIMMER
+  #include "ShiftDimmer.h"
+  #endif
+// Shortest BCM plane, the frame lasts 255 times this (raised by ShiftDimmer::setup() to the measured interrupt cost)
+#define OUTPUT_DIMMER_BASE_US 32
+// After a (re)connect, the retained outputs are applied at once after this delay
+#define OUTPUT_SYNC_MS 300
 #endif
 #ifdef MODE_CORE
-  #ifdef WITH_DS18
-  #include "DS18x.h"
-  #endif
-#define MQTT_CORE_SENSORS_PREFIX MQTT_ROOT_TOPIC "/SENSOR/"
+// Temperature sensors on the core itself : rather use a SENSOR node, the OneWire reads delay the core loop
+//#define WITH_DS18
 #define MQTT_SHORT_NAME  "CORE NODE #%d - UID#%d"
 #define MQTT_SHORT_TOPIC "/CORE/%d"
 #endif
+#ifdef MODE_TRACE
+  #include "Ssd1306Text.h"
+#define MQTT_SHORT_NAME  "TRACE NODE #%d - UID#%d"
+#define MQTT_SHORT_TOPIC "/TRACE/%d"
+#endif
+#ifdef MODE_SENSOR
+#define WITH_DS18
+#define MQTT_SHORT_NAME  "SENSOR NODE #%d - UID#%d"
+#define MQTT_SHORT_TOPIC "/SENSOR/%d"
+#endif
+
+#ifdef WITH_DS18
+#include "DS18x.h"
+#endif
 
 
 // Generic STATUS publish topic ROOT/STATUS/TYPE/node_id (FMT => %d)
@@ -158,10 +234,12 @@ const int mqtt_broker_port = 1883;
 // ----------------------------------------------------------------------------
 // ARDUINO #
 
-// Leaves room for some outputs, 2 core, 4 inputs
+// Leaves room for some outputs, 2 core, 4 inputs, 4 traces, 4 sensors
 #define OUTPUT_BASE 248
 #define CORE_BASE 244
 #define INPUT_BASE 240
+#define TRACE_BASE 236
+#define SENSOR_BASE 232
 
 #ifdef MODE_OUTPUT
 #define XBASE OUTPUT_BASE
@@ -169,9 +247,17 @@ const int mqtt_broker_port = 1883;
 #ifdef MODE_INPUT
 #define XBASE INPUT_BASE
 #else
+#ifdef MODE_TRACE
+#define XBASE TRACE_BASE
+#else
+#ifdef MODE_SENSOR
+#define XBASE SENSOR_BASE
+#else
 #define XBASE CORE_BASE
 #endif
 #endif
+#endif
+#endif
 
 int freeRam()
 {
@@ -180,6 +266,13 @@ int freeRam()
   return (int) &v - (__brkval == 0 ? (int) &__heap_start : (int) __brkval);
 }
 
+// Flash used by this build : code + initialized data image
+unsigned int flashUsed()
+{
+  extern char __data_load_end;
+  return (unsigned int) &__data_load_end;
+}
+
 // Unique arduino number
 byte arduinoNumber = 0xFF;
 
@@ -235,9 +328,46 @@ int getArduinoNumber()
 void mqtt_input_callback(char* topic, byte* payload, unsigned int length);
 void mqtt_output_callback(char* topic, byte* payload, unsigned int length);
 void mqtt_core_callback(char* topic, byte* payload, unsigned int length);
+void mqtt_trace_callback(char* topic, byte* payload, unsigned int length);
+
+/// Node counters : fixed size, cheap to update on the hot path, published and reset periodically
+struct NodeMetrics {
+  /// loop() iterations
+  unsigned long loops;
+  /// input chains scans, longest time between two scans (ms)
+  unsigned long scans;
+  unsigned int scan_gap_max;
+  /// MQTT messages received / published / failed to publish
+  unsigned int messages_in;
+  unsigned int messages_out;
+  unsigned int publish_failures;
+  /// output latches
+  unsigned int latches;
+  /// incoming bytes waiting at the start of a drain (max), drains stopped by the time budget
+  unsigned int backlog_max;
+  unsigned int drain_exhausted;
+  /// MQTT (re)connections since boot (never reset)
+  unsigned int reconnects;
+};
+
+NodeMetrics metrics;
+
+#ifdef WITH_TRACE
+//fwd
+void trace_report(byte origin, word sequence, long hop, unsigned long proc);
+#ifdef MODE_CORE
+extern bool core_syncing;
+#endif
+#endif
 
 // Common callback
 void MqttMessageCallback(char* topic, byte* payload, unsigned int length) {
+  metrics.messages_in++;
+
+#ifdef WITH_TRACE
+  // nb: the tag is removed, the callbacks only see the value
+  Trace::receive(payload, length);
+#endif
 
 #if 0 // log everything
   Serial.print("Message arrived [");
@@ -259,58 +389,205 @@ void MqttMessageCallback(char* topic, byte* payload, unsigned int length) {
 #ifdef MODE_CORE
   mqtt_core_callback(topic, payload, length);
 #endif
+#ifdef MODE_TRACE
+  mqtt_trace_callback(topic, payload, length);
+#endif
 
+#ifdef WITH_TRACE
+#ifdef MODE_CORE
+  // An input event was handled : report our hop and processing time
+  if (Trace::active && Trace::sender == Trace::origin && !core_syncing)
+  {
+    Trace::checkSequence();
+    trace_report(Trace::origin, Trace::sequence, Trace::hop(), millis() - Trace::rx);
+  }
+#endif
+  Trace::active = false;
+#endif
 }
 
 // ---------------------------------------------------------------------------
 
 /// Ethernet object
 EthernetClient ethClient;
+#ifdef WITH_BUFFERED_CLIENT
+/// Buffered writes and reads on the Ethernet object
+BufferedClient bufferedClient(ethClient);
+/// MQTT Client object
+PubSubClient mqttClient(mqtt_broker_address, mqtt_broker_port, MqttMessageCallback, bufferedClient);
+#else
 /// MQTT Client object
 PubSubClient mqttClient(mqtt_broker_address, mqtt_broker_port, MqttMessageCallback, ethClient);
+#endif
 /// Led blinker object
 Blink blink(STATUS_LED);
 
+/// Publish, counted in the metrics
+bool mqtt_publish(const char * topic, const char * payload, bool retain = false)
+{
+  bool ok = mqttClient.publish(topic, payload, retain);
+#ifdef WITH_BUFFERED_CLIENT
+  // nb: publish() succeeds once buffered : sent now, so that a failed write fails the publish (the caller retries)
+  unsigned int errors = bufferedClient.writeErrors;
+  bufferedClient.flush();
+  ok = ok && bufferedClient.writeErrors == errors;
+#endif
+  metrics.messages_out++;
+  if (!ok)
+    metrics.publish_failures++;
+  return ok;
+}
+
+#ifdef WITH_TRACE
+#define MQTT_TRACE_SUFFIX "/trace"
+
+/// Report a traced event on ROOT/STATUS/TYPE/<n>/trace = "<origin>.<sequence> hop=<ms> proc=<ms>"
+void trace_report(byte origin, word sequence, long hop, unsigned long proc)
+{
+  char topic[sizeof(MQTT_STATUS_PUBLISH_TOPIC MQTT_TRACE_SUFFIX) + 1];
+  snprintf(topic, sizeof(topic), MQTT_STATUS_PUBLISH_TOPIC MQTT_TRACE_SUFFIX, getArduinoNumber());
+  char payload[40];
+  snprintf(payload, sizeof(payload), "%u.%u hop=%ld proc=%lu", origin, sequence, hop, proc);
+  mqtt_publish(topic, payload);
+  Trace::record(hop + proc);
+}
+#endif
+
 // ---------------------------------------------------------------------------
 
 #ifdef MODE_INPUT
 
-// Not of much interest in topics for the inputs !
+#define INPUT_SNAPSHOT_MS 60000
+
+// Pulse counting on selected inputs (meters S0 outputs), sampled from the Timer2 interrupt
+#define WITH_PULSE
+  #ifdef WITH_PULSE
+  #include "PulseSampler.h"
+  #endif
+
+/// Publish the snapshots at the next loop
+bool input_snapshot_requested = true;
+/// Snapshot sequence, per 32 bits module
+word input_snapshot_sequence[SHIFT_INPUT_WORDS];
+
+// Not of much interest in topics for the inputs ! (only the snapshot requests)
 int mqtt_input_subscribe()
 {
-  return 1;
+  // new connection : new snapshots
+  input_snapshot_requested = true;
+  return mqttClient.subscribe(MQTT_INPUT_STATE_REQUEST);
 }
 ///
 /// Input mode : no interest in subscriptions for now, but we publish stuff, at least
 ///
 void mqtt_input_callback(char* topic, byte* payload, unsigned int length) {
-  // NOP NOW
+  if (!strcmp(topic, MQTT_INPUT_STATE_REQUEST))
+    input_snapshot_requested = true;
 }
 
 /// Input reader object
 IShiftCommon * _current_input;
 
-/// Callback  for inputs received
-bool onInputButton(int inputIndex, bool inputStatus)
+/// Topic of an input
+void input_topic(char * my_topic, size_t size, int inputIndex)
 {
-  char my_topic[sizeof(MQTT_IO_PUBLISH_TOPIC) + 2]; // "%d%d" turns into "999999" at worst so +2
-  
 #ifdef LINEAR_INPUT
   // Publish to base/IN/<id>/<flatindex>
-  snprintf(my_topic, sizeof(my_topic), MQTT_IO_PUBLISH_TOPIC, getArduinoNumber(), inputIndex);
+  snprintf(my_topic, size, MQTT_IO_PUBLISH_TOPIC, getArduinoNumber(), inputIndex);
 #else
   // Publish to base/IN/<id + index / 32 (slave modules)>/<index % 32  (per module)>
   auto arduinoModule = getArduinoNumber() + inputIndex / 32;
-  snprintf(my_topic, sizeof(my_topic), MQTT_IO_PUBLISH_TOPIC, arduinoModule, inputIndex % 32);
+  snprintf(my_topic, size, MQTT_IO_PUBLISH_TOPIC, arduinoModule, inputIndex % 32);
 #endif
+}
+
+/// Callback  for inputs received
+bool onInputButton(int inputIndex, bool inputStatus)
+{
+  char my_topic[sizeof(MQTT_IO_PUBLISH_TOPIC) + 2]; // "%d%d" turns into "999999" at worst so +2
+  input_topic(my_topic, sizeof(my_topic), inputIndex);
   
   Serial.print("Publishing to '"); Serial.print(my_topic); Serial.print("' = "); Serial.println(inputStatus ? "1" : "0");
 
-  bool ok = mqttClient.publish(my_topic, inputStatus ? "1" : "0");
+#ifdef WITH_TRACE
+  char payload[32];
+  Trace::tag(payload, sizeof(payload), inputStatus ? "1" : "0", UNIQUE_ID_ARDUINO_NUMBER);
+  bool ok = mqtt_publish(my_topic, payload);
+#else
+  bool ok = mqtt_publish(my_topic, inputStatus ? "1" : "0");
+#endif
   blink.set(ok ? Blink::BlinkMode::blink_white : Blink::BlinkMode::blink_fast);
   return ok;
 }
 
+/// The input engine, for all the topologies
+ShiftInput input_engine(onInputButton, PIN_INPUT_PL, PIN_INPUT_CE, PIN_INPUT_CP, {PIN_INPUT_DATA0, PIN_INPUT_DATA1, PIN_INPUT_DATA2});
+
+#ifdef WITH_PULSE
+#define PULSE_PUBLISH_MS 60000
+#define MQTT_PULSE_SUFFIX "/pulse"
+
+/// Inputs counted as pulses (flat index, as the events), END terminated
+PulseCounter pulse_table[] = {
+  //          input  filter ms  pulse ms
+  // TEST ONLY
+  //PulseCounter(30,    5,         30),     // energy meter S0 1000 imp/kWh : rate = W
+
+  // END
+  PulseCounter()
+};
+
+/// Sampler of the counted bits (interrupt)
+PulseSampler pulse_sampler(PIN_INPUT_PL, PIN_INPUT_CE, PIN_INPUT_CP, {PIN_INPUT_DATA0, PIN_INPUT_DATA1, PIN_INPUT_DATA2});
+
+/// Publish ROOT/IN/<module>/<n>/pulse = "total=<pulses> rate=<per hour> missed=<estimation>" periodically (counted by the interrupt)
+void pulse_loop()
+{
+  static unsigned long publish_millis = 0;
+  unsigned long elapsed = millis() - publish_millis;
+  if (elapsed < PULSE_PUBLISH_MS || !mqttClient.connected())
+    return;
+  publish_millis = millis();
+
+  for (int idx = 0; pulse_table[idx].input >= 0; idx++)
+  {
+    PulseCounter & counter = pulse_table[idx];
+    char topic[sizeof(MQTT_IO_PUBLISH_TOPIC MQTT_PULSE_SUFFIX) + 2];
+    input_topic(topic, sizeof(topic), counter.input);
+    strcat(topic, MQTT_PULSE_SUFFIX);
+    noInterrupts();
+    unsigned long total = counter.total;
+    unsigned long rate = counter.Rate(elapsed);
+    unsigned long missed_milli = counter.missed_milli;
+    interrupts();
+    char payload[48];
+    snprintf(payload, sizeof(payload), "total=%lu rate=%lu missed=%lu", total, rate, (missed_milli + 500) / 1000);
+    mqtt_publish(topic, payload);
+  }
+}
+#endif
+
+/// Publish the full state of each 32 bits module on ROOT/IN/<module>/state, periodically or on request
+/// nb: only the states whose events were published, so a snapshot never contradicts the events before it
+void input_snapshot_loop()
+{
+  static unsigned long publish_millis = 0;
+  if ((!input_snapshot_requested && millis() - publish_millis < INPUT_SNAPSHOT_MS) || !mqttClient.connected())
+    return;
+  publish_millis = millis();
+  input_snapshot_requested = false;
+
+  const InputBits & state = input_engine.state();
+  for (byte w = 0; w < input_engine.words(); w++)
+  {
+    char topic[sizeof(MQTT_ROOT_TOPIC MQTT_SHORT_TOPIC MQTT_INPUT_STATE_SUFFIX) + 2];
+    snprintf(topic, sizeof(topic), MQTT_ROOT_TOPIC MQTT_SHORT_TOPIC MQTT_INPUT_STATE_SUFFIX, getArduinoNumber() + w);
+    char payload[16];
+    snprintf(payload, sizeof(payload), "%x %08lx", ++input_snapshot_sequence[w], state.w[w]);
+    mqtt_publish(topic, payload);
+  }
+}
+
 // Read DIP SWITCH (Chain length)
 // SET Specific PINS
 // Initialize status
@@ -339,28 +616,49 @@ void setup_input()
   // T > 0 : lire tout en local sur plein de bits
   switch (_input_chain_length)
   {
-    default://int ploadPin,int clockEnablePin,int clockPin, int (&dataPins)[INS]
+    default://bits per branch, branches
     case 0:  // T = 0, read local chips + slave1 + slave2
       if (option1_no_slaves)
-        _current_input = new ShiftInput<32, 1, 32>(onInputButton, PIN_INPUT_PL, PIN_INPUT_CE, PIN_INPUT_CP, { PIN_INPUT_DATA0 });
+        input_engine.configure(32, 1);
       else
-        _current_input = new ShiftInput<32, 3, 96>(onInputButton, PIN_INPUT_PL, PIN_INPUT_CE, PIN_INPUT_CP, {PIN_INPUT_DATA0, PIN_INPUT_DATA1, PIN_INPUT_DATA2});
+        input_engine.configure(32, 3);
       break;
     case 1:  // T = 1, read local + 1 chained chips
-      _current_input = new ShiftInput<64, 1, 64>(onInputButton, PIN_INPUT_PL, PIN_INPUT_CE, PIN_INPUT_CP, {PIN_INPUT_DATA0});
+      input_engine.configure(64, 1);
       break;
     case 2:  // T = 2, read local + 2 chained chips
-      _current_input = new ShiftInput<96, 1, 96>(onInputButton, PIN_INPUT_PL, PIN_INPUT_CE, PIN_INPUT_CP, {PIN_INPUT_DATA0});
+      input_engine.configure(96, 1);
       break;
     case 3:  // T = 3, read local + 3 chained chips
-      _current_input = new ShiftInput<128, 1, 128>(onInputButton, PIN_INPUT_PL, PIN_INPUT_CE, PIN_INPUT_CP, {PIN_INPUT_DATA0});
+      input_engine.configure(128, 1);
       break;
   }
+  _current_input = &input_engine;
+
+#ifdef WITH_PULSE
+  // Counted inputs : no events
+  for (int idx = 0; pulse_table[idx].input >= 0; idx++)
+  {
+    if (pulse_table[idx].input < input_engine.outs())
+      input_engine.count(pulse_table[idx].input);
+    else
+    {
+      Serial.print("Pulse input out of the topology : "); Serial.println(pulse_table[idx].input);
+    }
+  }
+#endif
 
   // specific SETUP
   if (_current_input)
     _current_input->setup();
 
+#ifdef WITH_PULSE
+  // Counted inputs sampled by the interrupt, held during the reads of the main loop
+  pulse_sampler.setup(pulse_table, input_engine.bits(), input_engine.outs());
+  if (pulse_sampler.running())
+    input_engine.hold(&PulseSampler::hold);
+#endif
+
 }
 
 
@@ -370,6 +668,21 @@ void input_loop()
   // Read inputs in function of the configurated topology (slaves/chains, #items)
   if (_current_input)
     _current_input->loop();
+  metrics.scans++;
+
+  // Scan regularity : delay of the events
+  static unsigned long scan_millis = millis();
+  unsigned long gap = millis() - scan_millis;
+  scan_millis = millis();
+  metrics.scan_gap_max = max(metrics.scan_gap_max, (unsigned int)min(gap, 65535UL));
+#ifdef WITH_PULSE
+  pulse_loop();
+#endif
+
+#ifndef LINEAR_INPUT
+  // Anti-entropy (module naming only)
+  input_snapshot_loop();
+#endif
 }
 
 #endif
@@ -380,24 +693,193 @@ void input_loop()
 
 ShiftOutput outputShiftRegister(PIN_OUTPUT_DATA, PIN_OUTPUT_CLOCK, PIN_OUTPUT_LATCH, PIN_OUTPUT_OE);
 
+#ifdef WITH_OUTPUT_SNAPSHOT
+OutputSnapshot outputSnapshot(0);
+#endif
+
+#ifdef WITH_DIMMER
+/// Outputs accepting a 0-255 level, END terminated (the others stay on/off)
+const int output_dimmable_table[] = {
+  // TEST ONLY
+  //0, 1,     // LED drivers
+  //20,       // fan SSR
+
+  // END
+  -1
+};
+unsigned long output_dimmable_mask = 0;
+
+ShiftDimmer output_dimmer(PIN_OUTPUT_DATA, PIN_OUTPUT_CLOCK, PIN_OUTPUT_LATCH, 4);
+#endif
+
+/// Our own topics prefix, e.g. ROOT/OUT/3/ (computed once in setup)
+char output_topic_prefix[sizeof(MQTT_IO_SUBSCRIBE_TOPIC_COMMON) + 1];
+size_t output_topic_prefix_length;
+
+/// Outputs modified and not applied yet
+bool output_dirty = false;
+/// Local pulses : timers, running pulse timer per output, outputs in a pulse (never kept in the EEPROM snapshot)
+TimerWheel output_timers;
+byte output_pulse_timer[32];
+unsigned long output_pulse_mask = 0;
+/// millis() of the last subscription : the retained outputs replayed by the broker are batched
+unsigned long output_sync_millis = 0;
+
+#ifdef WITH_TRACE
+/// Last traced value, reported when latched
+struct {
+  bool pending;
+  byte origin;
+  word sequence;
+  long hop;
+  unsigned long rx;
+} output_trace;
+#endif
+
+/// First step of the boot, before the network (which may never come up) : the outputs are restored at once
+void setup_output_restore()
+{
+  // nb: before setup_common(), for the snapshot messages
+  Serial.begin(115200);
+
+  memset(output_pulse_timer, TimerWheel::NO_TIMER, sizeof(output_pulse_timer));
+
+#ifdef WITH_OUTPUT_SNAPSHOT
+  // Restore the last outputs : latched once, before the outputs are enabled
+  outputShiftRegister.set(outputSnapshot.load());
+#endif
+
+  // Setup outpin pins for shift registers
+  outputShiftRegister.setup();
+}
+
+void setup_output()
+{
+  snprintf(output_topic_prefix, sizeof(output_topic_prefix), MQTT_IO_SUBSCRIBE_TOPIC_COMMON "/", getArduinoNumber());
+  output_topic_prefix_length = strlen(output_topic_prefix);
+
+#ifdef WITH_DIMMER
+  for (int idx = 0; output_dimmable_table[idx] >= 0; idx++)
+    output_dimmable_mask |= 1UL << output_dimmable_table[idx];
+  // nb: the restored outputs are full on, the retained levels follow
+  for (int outputId = 0; outputId < 32; outputId++)
+    output_dimmer.setLevel(outputId, outputShiftRegister.getOutputStatus(outputId) ? 255 : 0);
+  output_dimmer.apply();
+  output_dimmer.setup(OUTPUT_DIMMER_BASE_US);
+#endif
+}
 
 int mqtt_output_subscribe() // Very important for the outputs
 {
   char my_topic[sizeof(MQTT_IO_SUBSCRIBE_TOPIC)];
   snprintf(my_topic, sizeof(my_topic), MQTT_IO_SUBSCRIBE_TOPIC, getArduinoNumber());
   Serial.print("Subscribing to '"); Serial.print(my_topic); Serial.println("'");
+  output_sync_millis = millis();
   return mqttClient.subscribe(my_topic);
 }
 
 
 /// apply the settings on the real world :
 /// let's talk to all of these 74HC595 !
+/// @param outputId 0..31, checked by the caller
 void on_output_value(int outputId, int current_value)
 {
+  // a plain value ends a running pulse
+  if (output_pulse_timer[outputId] != TimerWheel::NO_TIMER)
+  {
+    output_timers.cancel(output_pulse_timer[outputId]);
+    output_pulse_timer[outputId] = TimerWheel::NO_TIMER;
+    output_pulse_mask &= ~(1UL << outputId);
+  }
+
+#ifdef WITH_DIMMER
+  // 0-255 on the dimmable outputs, on/off (255) on the others
+  byte level = (output_dimmable_mask >> outputId) & 1 ? constrain(current_value, 0, 255) : (current_value != 0 ? 255 : 0);
+  if (output_dimmer.level(outputId) == level)
+    return;
+  output_dimmer.setLevel(outputId, level);
+#else
+  // nb: the retained values matching the restored outputs change nothing
+  if (outputShiftRegister.getOutputStatus(outputId) == (current_value != 0))
+    return;
+#endif
   outputShiftRegister.setBit(outputId, current_value != 0);
-  outputShiftRegister.apply();
+  output_dirty = true;
+
+#ifdef WITH_TRACE
+  // nb: not the retained values of the sync
+  if (Trace::active && millis() - output_sync_millis > OUTPUT_SYNC_MS)
+  {
+    output_trace.pending = true;
+    output_trace.origin = Trace::origin;
+    output_trace.sequence = Trace::sequence;
+    output_trace.hop = Trace::hop();
+    output_trace.rx = Trace::rx;
+  }
+#endif
+}
+
+/// End of a local pulse : off, and the resulting state published
+void output_pulse_end(void * context)
+{
+  int outputId = (int)(intptr_t)context;
+  output_pulse_timer[outputId] = TimerWheel::NO_TIMER;
+  output_pulse_mask &= ~(1UL << outputId);
+  on_output_value(outputId, 0);
+
+  char topic[sizeof(output_topic_prefix) + 2];
+  snprintf(topic, sizeof(topic), "%s%d", output_topic_prefix, outputId);
+  mqtt_publish(topic, "0", true);
+}
+
+/// Local timed pulse : on now, off after pulse_ms (a running pulse restarts)
+void on_output_pulse(int outputId, int pulse_ms)
+{
+  on_output_value(outputId, 255);
+  byte t = output_timers.arm(millis() + pulse_ms, &output_pulse_end, (void *)(intptr_t)outputId);
+  if (t == TimerWheel::NO_TIMER)
+  {
+    // nb: never left on
+    on_output_value(outputId, 0);
+    return;
+  }
+  output_pulse_timer[outputId] = t;
+  output_pulse_mask |= 1UL << outputId;
+}
+
+// OUTPUT loop : apply the modified outputs at once
+void output_loop()
+{
+  // Pulses due : their end is latched below, in the same loop
+  output_timers.loop();
+
+  // Wait for the end of the retained messages storm after a subscription
+  if (output_dirty && millis() - output_sync_millis > OUTPUT_SYNC_MS)
+  {
+#ifdef WITH_DIMMER
+    output_dimmer.apply();
+#else
+    outputShiftRegister.apply();
+#endif
+    metrics.latches++;
+    output_dirty = false;
+#ifdef WITH_TRACE
+    if (output_trace.pending)
+    {
+      output_trace.pending = false;
+      trace_report(output_trace.origin, output_trace.sequence, output_trace.hop, millis() - output_trace.rx);
+    }
+#endif
+#ifdef WITH_OUTPUT_SNAPSHOT
+    outputSnapshot.request(outputShiftRegister.get() & ~output_pulse_mask);
+#endif
 #if 0
-  Serial.print("Outputs: "); Serial.println(outputShiftRegister.get(), BIN);
+    Serial.print("Outputs: "); Serial.println(outputShiftRegister.get(), BIN);
+#endif
+  }
+
+#ifdef WITH_OUTPUT_SNAPSHOT
+  outputSnapshot.loop();
 #endif
 }
 
@@ -405,23 +887,21 @@ void on_output_value(int outputId, int current_value)
 /// Output mode : we just read the MQTT topics, and apply the values to the output transistors
 ///
 void mqtt_output_callback(char* topic, byte* payload, unsigned int length) {
-  // Starts from our original topic : e.g. ROOT/OUT/3
-  char my_topic[sizeof(MQTT_IO_SUBSCRIBE_TOPIC_COMMON)];
-  snprintf(my_topic, sizeof(my_topic), MQTT_IO_SUBSCRIBE_TOPIC_COMMON, getArduinoNumber());
-  int lt = strlen(my_topic);
-  int ltt = strlen(topic);
+  // Starts from our original topic : e.g. ROOT/OUT/3/
+  const char * tail = MqttParse::suffix(topic, output_topic_prefix, output_topic_prefix_length);
+  int outputId, my_topic_val;
+
+  // Local pulse : "p<ms>"
+  if (tail != NULL && strlen(tail) <= 2 && MqttParse::toInt(tail, outputId) && outputId >= 0 && outputId < 32
+      && length > 1 && payload[0] == OUTPUT_PULSE_PREFIX && MqttParse::toInt(payload + 1, length - 1, my_topic_val) && my_topic_val > 0) {
+    on_output_pulse(outputId, my_topic_val);
+    return;
+  }
 
   // If the topics starts correctly from the right value, and continues with a slash
-  // also, keep out fool values !
-  if (!strncmp(topic, my_topic, lt) && topic[lt] == '/' && (ltt - lt <= 3) && (length < 4)) {
-    lt++;
-    // Expected : numeric
-    int outputId = atoi(& topic[lt]);
-    // Expected : numeric payload
-    int payload_length_retained = min(sizeof(my_topic) - 1, min(length, 10));
-    memcpy(my_topic, payload, payload_length_retained); // numeric size.. not that large !
-    my_topic[payload_length_retained] = 0;
-    int my_topic_val = atoi(my_topic);
+  // also, keep out fool values ! Expected : numeric output id (2 digits), numeric payload
+  if (tail != NULL && strlen(tail) <= 2 && MqttParse::toInt(tail, outputId) && outputId >= 0 && outputId < 32
+      && (length < 4) && MqttParse::toInt(payload, length, my_topic_val)) {
     on_output_value(outputId, my_topic_val); // apply the settings on the real world
 
 #if 0
@@ -433,6 +913,81 @@ void mqtt_output_callback(char* topic, byte* payload, unsigned int length) {
   }
 }
 
+#ifdef WITH_BENCH
+void output_bench()
+{
+  char topic[sizeof(MQTT_IO_SUBSCRIBE_TOPIC_COMMON) + 4];
+  snprintf(topic, sizeof(topic), MQTT_IO_SUBSCRIBE_TOPIC_COMMON "/%d", getArduinoNumber(), 5);
+  output_sync_millis = millis() - OUTPUT_SYNC_MS - 1;
+  // nb: includes the apply() on the 74HC595 ; the output toggled is put back afterwards
+  bool before = outputShiftRegister.getOutputStatus(5);
+  Bench::run("output_callback", 200, [&](unsigned long i) { mqtt_output_callback(topic, (byte*)((i & 1) ? "1" : "0"), 1); output_loop(); });
+  on_output_value(5, before ? 255 : 0);
+  output_loop();
+
+#ifdef WITH_DIMMER
+  // BCM frame (8 plane shifts) : the shortest plane must outlast one interrupt, refresh max = 8e9 / (255 x ns per frame) Hz
+  // nb: the running interrupt is paused, the planes are shifted but never latched
+  output_dimmer.pause();
+  for (byte chips = 4; chips <= 8; chips += 4)
+  {
+    ShiftDimmer dimmer(PIN_OUTPUT_DATA, PIN_OUTPUT_CLOCK, PIN_OUTPUT_LATCH, chips);
+    char name[24];
+    snprintf(name, sizeof(name), "bcm_frame_%d", chips * 8);
+    Bench::run(name, 100, [&](unsigned long i) {
+      for (byte p = 0; p < ShiftDimmer::PLANES; p++)
+        dimmer.measure();
+    });
+  }
+  output_dimmer.resume();
+#endif
+}
+#endif
+
+#endif
+
+// -------------------------------------------------------------------------------
+// Temperature sensors : SENSOR node, or CORE node WITH_DS18
+
+#ifdef WITH_DS18
+/// Sensors known at most, all buses (registry : 22 bytes of SRAM per sensor)
+#define DS18_SENSORS 16
+ManyDS18X temperature_sensors({ PIN_ONEWIREPINS }, DS18_SENSORS);
+
+DS18Settings ds18_settings_table[] = {
+  // address (printAddress)  bits  margin           min period  max period
+
+  // Heating loops : fast reaction
+  //{ "28ff641e0f1603a1",    12,   DS18_RAW(0.05),  2000,       30000 },
+
+  // END : default for all other sensors (rooms : cheap)
+  { NULL,                    10,   DS18_RAW(0.1),   15000,      300000 },
+};
+
+#ifdef WITH_BENCH
+void ds18_bench()
+{
+  DeviceAddress address = { 0x28, 0xff, 0x64, 0x1e, 0x0f, 0x16, 0x03, 0xa1 };
+  char buffer[18];
+  Bench::run("ds18_print_address", 200, [&](unsigned long i) { printAddress(buffer, sizeof(buffer), address); });
+  Bench::run("ds18_print_temperature", 200, [&](unsigned long i) { printTemperature(buffer, sizeof(buffer), 344 + i); });
+}
+#endif
+#endif
+
+#ifdef MODE_SENSOR
+/// SENSOR mode : nothing to receive, the OneWire buses are the whole loop
+void setup_sensor()
+{
+  // 1-wire sensors auto-detection
+  temperature_sensors.setup(MQTT_SENSORS_PREFIX, &mqtt_publish, ds18_settings_table);
+}
+
+void sensor_loop()
+{
+  // 1-wire sensors probe and publish variations
+  temperature_sensors.loop();
+}
 #endif
 
 // -------------------------------------------------------------------------------
@@ -440,6 +995,11 @@ void mqtt_output_callback(char* topic, byte* payload, unsigned int length) {
 #ifdef MODE_CORE
 
 #define WITH_COVER
+#define WITH_GESTURE
+#define WITH_RULES
+#define WITH_INPUT_STATE
+// The output nodes time the impulses themselves ("p<ms>" payload, see OUTPUT_PULSE_PREFIX)
+#define WITH_OUTPUT_PULSE
 
 //                    [NODE 0 (master)]  [Slave 1]    [Slave 2]
 // flattened naming:   /IN/0/0-31        /IN/0/32-63  /IN/0/64-95
@@ -465,6 +1025,7 @@ struct CoreIODef
   /// Output MQTT topic (reversed logic : security when two outputs cannot be active at the same time)
   const char *           output_topic_inv;
   /// Delay "on" in milliseconds (output automatically set to off after delay)
+  /// With behave_only_on_when_input_on : safety bound, off after this delay even if the input stays on (WITH_OUTPUT_PULSE)
   unsigned short         max_impulse_on_ms;
   /// Behaviour : alternative : only on when input is on
   bool                   behave_only_on_when_input_on;
@@ -611,7 +1172,7 @@ CoreIODef core_io_table[] = {
 
 
   // Push Switch entrance -> ring bell
-  { "MDB/IN/2/19", "MDB/OUT/1/22", NULL, 0, true }, // no toggle
+  { "MDB/IN/2/19", "MDB/OUT/1/22", NULL, 5000, true }, // no toggle, 5 s at most
 
   // TEST ONLY
   //{ "MDB/IN/0/56", "MDB/OUT/1/2", "MDB/OUT/1/1" },
@@ -642,9 +1203,71 @@ Cover cover_table[] = {
 };
 #endif
 
+#ifdef WITH_GESTURE
 
-#ifdef WITH_DS18
-ManyDS18X temperature_sensors({ PIN_CORE_ONEWIREPINS }); 
+Gesture gesture_table[] = {
+  // Press patterns resolved locally (an input should not be toggled by core_io_table too)
+  //input_topic,  gesture,               action topic,   payload, [time_long, time_double, time_repeat, retain]
+
+  // TEST ONLY
+  //Gesture("MDB/IN/0/28", Gesture_click,        "MDB/OUT/1/2",  "1"),
+  //Gesture("MDB/IN/0/28", Gesture_double_click, "MDB/OUT/1/2",  "0"),
+  //Gesture("MDB/IN/0/28", Gesture_long_press,   "MDB/OUT/0/7",  "0"), // all off
+  //Gesture("MDB/IN/0/28", Gesture_long_press,   "MDB/OUT/0/8",  "0"),
+  //Gesture("MDB/IN/0/29", Gesture_hold_repeat,  "MDB/DIM/0/1",  "+", 600, 350, 200, false),
+
+  // END
+  Gesture( )
+};
+#endif
+
+#ifdef WITH_RULES
+
+// Signals read or written by the rules (index = position in the table)
+const char * const rules_signal_table[] = {
+  // TEST ONLY
+  //"MDB/IN/0/26",                            // 0 : kitchen switch
+  //"MDB/NR/NIGHT",                           // 1 : night flag
+  //MQTT_SENSORS_PREFIX "28ff641e0f1603a1", // 2 : kitchen temperature
+  //"MDB/OUT/1/21",                           // 3 : VMC trap
+
+  // END
+  NULL
+};
+
+// Rules program : values in hundredths, see Rules.h
+const byte rules_program[] PROGMEM = {
+  // TEST ONLY
+  // VMC trap : kitchen switch AND temperature > 25.00
+  //RULE_SIG(0), RULE_SIG(2), RULE_CONST(2500), RULE_GT, RULE_AND, RULE_OUT(3),
+
+  // END
+  RULE_END
+};
+
+Rules rules(rules_signal_table, rules_program);
+#endif
+
+
+#ifdef WITH_RULES
+// Subscribe to the rule signals not already received through our wildcard subscriptions
+// nb: overlapping subscriptions could deliver an input twice, and toggle it twice
+bool mqtt_rules_subscribe()
+{
+  bool ok = true;
+  for (int idx = 0; rules_signal_table[idx] != NULL; idx++)
+  {
+    const char * signal = rules_signal_table[idx];
+    if (strncmp(signal, MQTT_ALL_INPUT, sizeof(MQTT_ALL_INPUT) - 2)
+        && strncmp(signal, MQTT_ALL_OUTPUT, sizeof(MQTT_ALL_OUTPUT) - 2)
+#ifdef WITH_COVER
+        && strncmp(signal, MQTT_COVER_ALL, sizeof(MQTT_COVER_ALL) - 2)
+#endif
+        && strcmp(signal, MQTT_NODERED_WATCHDOG))
+      ok = mqttClient.subscribe(signal) && ok;
+  }
+  return ok;
+}
 #endif
 
 int mqtt_core_subscribe() // Very important for the core logic
@@ -654,13 +1277,31 @@ int mqtt_core_subscribe() // Very important for the core logic
       && mqttClient.subscribe(MQTT_ALL_OUTPUT)
 #ifdef WITH_COVER     
       && mqttClient.subscribe(MQTT_COVER_ALL)
+#endif
+#ifdef WITH_RULES
+      && mqtt_rules_subscribe()
 #endif
       ;
 }
 
 bool publish_generic(const char * topic, const char * payload, bool retain)
 {
-  return mqttClient.publish(topic, payload, retain);
+#ifdef WITH_TRACE
+  // Outputs published while handling a traced event : propagate its tag
+  char traced[32];
+  if (Trace::active && !strncmp(topic, MQTT_ALL_OUTPUT, sizeof(MQTT_ALL_OUTPUT) - 2))
+  {
+    Trace::tag(traced, sizeof(traced), payload, UNIQUE_ID_ARDUINO_NUMBER);
+    payload = traced;
+  }
+#endif
+#ifdef WITH_REPLAY
+  return Replay::publish(topic, payload, retain);
+#endif
+#ifdef WITH_BENCH
+  return Bench::publish(topic, payload, retain);
+#endif
+  return mqtt_publish(topic, payload, retain);
 }
 
 
@@ -673,30 +1314,168 @@ void publish_output(const char * topic, bool status_active)
   }
 }
 
+#ifdef WITH_OUTPUT_PULSE
+/// Pulse timed by the output node, which publishes the "0" at its end
+/// nb: not retained, a reconnecting output node never replays it
+void publish_output_pulse(const char * topic, unsigned short pulse_ms)
+{
+  if (topic != NULL)
+  {
+    char payload[8];
+    snprintf(payload, sizeof(payload), "%c%u", OUTPUT_PULSE_PREFIX, pulse_ms);
+    publish_generic(topic, payload, false);
+  }
+}
+#endif
+
 // WATCHDOG
 #define WITH_WATCHDOG
 #define WATCHDOG_MILLIS 2500
-#define WATCHDOG_NOT_RECEIVED 9999
 
-int previous_watchdog = WATCHDOG_NOT_RECEIVED;
+/// Any change of the watchdog payload is a heartbeat (counter, timestamp or text) : only a hash of its bytes is kept
+bool watchdog_received = false;
+unsigned long previous_watchdog_hash = 0;
 long previous_watchdog_ms = 0;
 
+// STARTUP SYNC
+// After a (re)connect, the broker replays every retained message : they are only ingested in our
+// state tables, without any action, until our own sync marker comes back (or a timeout).
+#define CORE_SYNC_TIMEOUT_MS 5000
+#define MQTT_SYNC_SUFFIX "/sync"
+#define MQTT_READY_SUFFIX "/ready"
+
+/// True while the retained messages are ingested
+bool core_syncing = false;
+/// Messages ingested during the current sync
+unsigned int core_sync_messages = 0;
+/// Sync marker topic : ROOT/STATUS/CORE/<n>/sync
+char core_sync_topic[sizeof(MQTT_STATUS_PUBLISH_TOPIC MQTT_SYNC_SUFFIX) + 1];
+
+/// Sync phase callback : state only
+void core_sync_callback(char* topic, byte* payload, unsigned int length) {
+  if (!strcmp(topic, core_sync_topic))
+  {
+    // everything sent before our marker is received
+    core_syncing = false;
+    return;
+  }
+  core_sync_messages++;
+
+  // Output status
+  if (length == 1 && ((char)payload[0] == '1' || (char)payload[0] == '0'))
+    for (int idx = 0; core_io_table[idx].input_topic != NULL; idx++)
+      if (!strcmp(topic, core_io_table[idx].output_topic))
+        core_io_table[idx].input_status.current_status = ((char)payload[0] == '1');
+
+#ifdef WITH_COVER
+  for (int idx = 0; cover_table[idx].topic_cover != NULL; idx++)
+  {
+    cover_table[idx].Callback(topic, payload, length, false);
+  }
+#endif
+
+#ifdef WITH_RULES
+  rules.Callback(topic, payload, length);
+#endif
+}
+
+/// Ingest the retained messages, then report the reconnect to ready time
+#ifdef WITH_INPUT_STATE
+/// Core view of the inputs, see InputState.h
+InputState input_state(MQTT_ROOT_TOPIC "/IN/");
+#endif
+
+void core_sync(const char * status_topic, unsigned long connect_millis)
+{
+  snprintf(core_sync_topic, sizeof(core_sync_topic), "%s" MQTT_SYNC_SUFFIX, status_topic);
+  core_syncing = true;
+  core_sync_messages = 0;
+  unsigned long sync_millis = millis();
+
+  // nb: the broker delivers in order, our marker comes after the retained messages of our subscriptions
+  if (mqttClient.subscribe(core_sync_topic) && mqtt_publish(core_sync_topic, "?"))
+  {
+    // Drain the messages as fast as possible
+    while (core_syncing && millis() - sync_millis < CORE_SYNC_TIMEOUT_MS && mqttClient.loop())
+      ;
+  }
+  core_syncing = false;
+
+  char ready_topic[sizeof(MQTT_STATUS_PUBLISH_TOPIC MQTT_READY_SUFFIX) + 1];
+  snprintf(ready_topic, sizeof(ready_topic), "%s" MQTT_READY_SUFFIX, status_topic);
+  char report[40];
+  snprintf(report, sizeof(report), "ready_ms=%lu sync_ms=%lu msgs=%u", millis() - connect_millis, millis() - sync_millis, core_sync_messages);
+  Serial.print("Sync done : "); Serial.println(report);
+  mqtt_publish(ready_topic, report, true);
+
+#ifdef WITH_INPUT_STATE
+  // The input events lost while we were away are fixed by the snapshots
+  mqtt_publish(MQTT_INPUT_STATE_REQUEST, "?");
+#endif
+}
+
+/// Timeouts of the core node : impulses and covers end of move
+TimerWheel core_timers;
+/// A timer could not be armed : the impulses are polled until they end
+bool core_impulse_poll = false;
+
+//fwd
+void core_impulse_arm(CoreIODef * io);
+
+/// Switch off an impulse if its maximum time is over, @return true if ended
+bool core_impulse_end(CoreIODef * io)
+{
+  // nb: the delta (now - start > delay) handles correctly the millis() rollover after 49 days !
+  if (millis() - io->input_status.start_millis <= (unsigned long)io->max_impulse_on_ms)
+    return false;
+  io->input_status.start_millis = 0;
+  publish_output(io->output_topic, false);
+  return true;
+}
+
+/// Impulse timer : switch off, or wait the remaining time if extended meanwhile
+void core_impulse_timeout(void * context)
+{
+  CoreIODef * io = (CoreIODef *) context;
+  if (io->input_status.start_millis != 0 && !core_impulse_end(io))
+    core_impulse_arm(io);
+}
+
+void core_impulse_arm(CoreIODef * io)
+{
+  if (core_timers.arm(io->input_status.start_millis + io->max_impulse_on_ms + 1, &core_impulse_timeout, io) == TimerWheel::NO_TIMER)
+    core_impulse_poll = true;
+}
+
 ///
 /// Our common logic - listen to ALL inputs and apply output logic
 ///
 void mqtt_core_callback(char* topic, byte* payload, unsigned int length) {
+  // Startup sync : no action
+  if (core_syncing)
+  {
+    core_sync_callback(topic, payload, length);
+    return;
+  }
+
+#ifdef WITH_INPUT_STATE
+  // Input snapshot : replay the lost events
+  if (input_state.Callback(topic, payload, length, mqtt_core_callback))
+    return;
+#endif
+
   // If its a watchdog
   if (!strcmp(MQTT_NODERED_WATCHDOG,topic))
   {
-     char my_buffer[8];
-     int payload_length_retained = min(sizeof(my_buffer) - 1, min(length, 6));
-     memcpy(my_buffer, payload, payload_length_retained); // numeric size.. not that large !
-     my_buffer[payload_length_retained] = 0;
-     int new_watchdog_value = atoi(my_buffer);
-     if (new_watchdog_value != previous_watchdog) {
-        previous_watchdog = new_watchdog_value;
+     // FNV-1a of the raw payload, whatever its length and format
+     unsigned long hash = 2166136261UL;
+     for (unsigned int i = 0; i < length; i++)
+       hash = (hash ^ payload[i]) * 16777619UL;
+     if (!watchdog_received || hash != previous_watchdog_hash) {
+        watchdog_received = true;
+        previous_watchdog_hash = hash;
         previous_watchdog_ms = millis();
-     }    
+     }
      return;
   }
 
@@ -704,11 +1483,11 @@ void mqtt_core_callback(char* topic, byte* payload, unsigned int length) {
   // Test watchdog : we are active if the watchdog is out of delay !
   if ( millis() - previous_watchdog_ms > (unsigned long)WATCHDOG_MILLIS )
   {
-      previous_watchdog = WATCHDOG_NOT_RECEIVED;
+      watchdog_received = false;
   }
   // Ignore some messages when others are sending the watchdogs correctly !
   // Otherwise we apply our simple yet effective logic !
-  bool supervisor_active = (WATCHDOG_NOT_RECEIVED != previous_watchdog);
+  bool supervisor_active = watchdog_received;
 #else
   bool supervisor_active = false;
 #endif
@@ -721,6 +1500,16 @@ void mqtt_core_callback(char* topic, byte* payload, unsigned int length) {
   }
 #endif
 
+#ifdef WITH_GESTURE
+  for (int idx = 0; gesture_table[idx].topic_input != NULL; idx++)
+  {
+    gesture_table[idx].Callback(topic, payload, length);
+  }
+#endif
+
+#ifdef WITH_RULES
+  rules.Callback(topic, payload, length);
+#endif
   
   // If it starts with an input..
 
@@ -748,14 +1537,32 @@ void mqtt_core_callback(char* topic, byte* payload, unsigned int length) {
       {
         if (on)
           publish_output(core_io_table[idx].output_topic_inv, false);
+#ifdef WITH_OUTPUT_PULSE
+        // bounded on : the release ends the pulse
+        if (on && core_io_table[idx].max_impulse_on_ms != 0 && core_io_table[idx].max_impulse_on_ms <= OUTPUT_PULSE_MAX_MS)
+          publish_output_pulse(core_io_table[idx].output_topic, core_io_table[idx].max_impulse_on_ms);
+        else
+#endif
         publish_output(core_io_table[idx].output_topic, on );
       }
+#ifdef WITH_OUTPUT_PULSE
+      else if (core_io_table[idx].max_impulse_on_ms != 0 && core_io_table[idx].max_impulse_on_ms <= OUTPUT_PULSE_MAX_MS && on)
+      {
+        // Impulse timed by the output node : one publish, a new press restarts it
+        publish_output(core_io_table[idx].output_topic_inv, false);
+        publish_output_pulse(core_io_table[idx].output_topic, core_io_table[idx].max_impulse_on_ms);
+      }
+#endif
       else if (core_io_table[idx].max_impulse_on_ms != 0 && on)
       {
         // Impulse with maximum length only
         auto timenow = millis();
         if (timenow == 0) timenow++;
+        // nb: a running impulse is extended, its timer re-arms itself for the remaining time
+        bool running = core_io_table[idx].input_status.start_millis != 0;
         core_io_table[idx].input_status.start_millis = timenow;
+        if (!running)
+          core_impulse_arm(&core_io_table[idx]);
 
         if (on)
           publish_output(core_io_table[idx].output_topic_inv, false);
@@ -784,19 +1591,24 @@ void mqtt_core_callback(char* topic, byte* payload, unsigned int length) {
   }
 }
 
-#define WITH_DS18
-
-
 void setup_core()
 {
   // 1-wire sensors auto-detection
 #ifdef WITH_DS18
-  temperature_sensors.setup(MQTT_CORE_SENSORS_PREFIX, &publish_generic);
+  temperature_sensors.setup(MQTT_SENSORS_PREFIX, &publish_generic, ds18_settings_table);
 #endif
   
   //  Cover roller handling
 #ifdef WITH_COVER
-  Cover::Setup(& publish_generic);
+  Cover::Setup(& publish_generic, &core_timers);
+#endif
+
+#ifdef WITH_GESTURE
+  Gesture::Setup(& publish_generic, gesture_table);
+#endif
+
+#ifdef WITH_RULES
+  rules.Setup(& publish_generic);
 #endif
   
 }
@@ -804,6 +1616,9 @@ void setup_core()
 
 void core_loop()
 {
+  // Due timeouts
+  core_timers.loop();
+
   // 1-wire sensors probe and publish variations
 #ifdef WITH_DS18
   temperature_sensors.loop();
@@ -816,18 +1631,223 @@ void core_loop()
     cover_table[idx].Loop();
   }
 #endif
+
+  // Press patterns
+#ifdef WITH_GESTURE
+  for (int idx = 0; gesture_table[idx].topic_input != NULL; idx++)
+  {
+    gesture_table[idx].Loop();
+  }
+#endif
+
+  // Local automations
+#ifdef WITH_RULES
+  rules.Loop();
+#endif
   
 
   // -----------------------------------------------------
   
-  // handle the maximum time impulses
+  // handle the maximum time impulses : only when out of timers (otherwise see core_impulse_timeout)
+  if (core_impulse_poll)
+  {
+    core_impulse_poll = false;
+    for (int idx = 0; core_io_table[idx].input_topic != NULL; idx++)
+      if (core_io_table[idx].input_status.start_millis != 0 && !core_impulse_end(&core_io_table[idx]))
+        core_impulse_poll = true;
+  }
+}
+
+#ifdef WITH_BENCH
+void core_bench()
+{
+  // Topic dispatch over the real tables
+  char topic_miss[] = MQTT_SENSORS_PREFIX "28ff641e0f1603a1";
+  char topic_output[] = "MDB/OUT/0/7";
+  char topic_input[] = "MDB/IN/0/0";
+  Bench::run("core_callback_miss", 200, [&](unsigned long i) { mqtt_core_callback(topic_miss, (byte*)"21.50", 5); });
+  Bench::run("core_callback_output", 200, [&](unsigned long i) { mqtt_core_callback(topic_output, (byte*)"1", 1); });
+  // nb: includes the serial debug prints of a found topic
+  Bench::run("core_callback_input", 200, [&](unsigned long i) { mqtt_core_callback(topic_input, (byte*)"0", 1); });
+
+#ifdef WITH_COVER
+  // All the covers moving
+  for (int idx = 0; cover_table[idx].topic_cover != NULL; idx++)
+  {
+    cover_table[idx].actual_pos = 50;
+    cover_table[idx].status_up = true;
+    cover_table[idx].Loop();
+  }
+  Bench::run("cover_loop_all_moving", 200, [&](unsigned long i) {
+    for (int idx = 0; cover_table[idx].topic_cover != NULL; idx++)
+      cover_table[idx].Loop();
+  });
+#endif
+}
+#endif
+
+#ifdef WITH_REPLAY
+// Final state of the logic, printed at the end of a replay
+void core_dump()
+{
   for (int idx = 0; core_io_table[idx].input_topic != NULL; idx++)
-    if (core_io_table[idx].input_status.start_millis != 0 &&
-        ( millis() - core_io_table[idx].input_status.start_millis > (unsigned long)core_io_table[idx].max_impulse_on_ms )) // nb: the delta (now - start > delay) handles correctly the millis() rollover after 49 days !
+  {
+    Serial.print("# "); Serial.print(core_io_table[idx].output_topic); Serial.print(" "); Serial.println(core_io_table[idx].input_status.current_status);
+  }
+#ifdef WITH_COVER
+  for (int idx = 0; cover_table[idx].topic_cover != NULL; idx++)
+  {
+    Serial.print("# "); Serial.print(cover_table[idx].topic_cover); Serial.print(" "); Serial.print((int)cover_table[idx].actual_pos);
+    Serial.print(" "); Serial.println((int)cover_table[idx].actual_state);
+  }
+#endif
+}
+
+// Scenario reconnect : the retained messages replayed by the broker only update the state
+void core_replay_sync(bool syncing)
+{
+  core_syncing = syncing;
+  core_sync_messages = 0;
+}
+#endif
+
+#endif
+
+// -------------------------------------------------------------------------------
+
+#ifdef MODE_TRACE
+
+/// Selected I/O topics, shown on the last row, NULL terminated
+const char * trace_io_table[] = {
+  "MDB/IN/2/0",
+  "MDB/OUT/0/22",
+  NULL
+};
+
+/// Compact model of a node, from ROOT/STATUS/<TYPE>/<n>[/...]
+struct TraceNode {
+  /// first letter of the type : I(N), O(UT), C(ORE), T(RACE), S(ENSOR)
+  char type;
+  byte number;
+  /// last status : 1 alive, 0 last will
+  bool online;
+  /// loops per second (metrics), last traced latency (ms)
+  unsigned int lps;
+  unsigned int latency;
+};
+
+/// One row per node
+#define TRACE_MAX_NODES (Ssd1306Text::ROWS - 2)
+#define MQTT_STATUS_PREFIX MQTT_ROOT_TOPIC "/STATUS/"
+
+TraceNode trace_nodes[TRACE_MAX_NODES];
+byte trace_node_count = 0;
+/// Messages received, last selected I/O event
+unsigned int trace_messages = 0;
+char trace_last_io[Ssd1306Text::COLS + 1] = "";
+/// Model changed since the last render
+bool trace_dirty = true;
+
+Ssd1306Text display;
+
+int mqtt_trace_subscribe()
+{
+  bool ok = mqttClient.subscribe(MQTT_ALL_STATUS);
+  for (int idx = 0; trace_io_table[idx] != NULL; idx++)
+    ok = mqttClient.subscribe(trace_io_table[idx]) && ok;
+  return ok;
+}
+
+/// Numeric field "<key><value>" of a payload, e.g. "lps=" in "up=12 lps=3456 ..." (0 if missing)
+unsigned int trace_field(const byte * payload, unsigned int length, const char * key)
+{
+  size_t keyLength = strlen(key);
+  for (unsigned int i = 0; i + keyLength < length; i++)
+    if (!memcmp(payload + i, key, keyLength) && (i == 0 || payload[i - 1] == ' '))
+    {
+      unsigned long v = 0;
+      for (i += keyLength; i < length && payload[i] >= '0' && payload[i] <= '9'; i++)
+        v = v * 10 + (payload[i] - '0');
+      return min(v, 65535UL);
+    }
+  return 0;
+}
+
+/// Node of the model (added if room)
+TraceNode * trace_node(char type, byte number)
+{
+  for (byte i = 0; i < trace_node_count; i++)
+    if (trace_nodes[i].type == type && trace_nodes[i].number == number)
+      return &trace_nodes[i];
+  if (trace_node_count == TRACE_MAX_NODES)
+    return NULL;
+  TraceNode * node = &trace_nodes[trace_node_count++];
+  memset(node, 0, sizeof(TraceNode));
+  node->type = type;
+  node->number = number;
+  return node;
+}
+
+///
+/// Trace mode : update the model only, the screen follows in trace_loop()
+///
+void mqtt_trace_callback(char* topic, byte* payload, unsigned int length) {
+  trace_messages++;
+  trace_dirty = true;
+
+  // ROOT/STATUS/<TYPE>/<n>[/<what>]
+  const char * tail = MqttParse::suffix(topic, MQTT_STATUS_PREFIX, sizeof(MQTT_STATUS_PREFIX) - 1);
+  if (tail == NULL)
+  {
+    // Selected I/O : "IN/2/0=1"
+    snprintf(trace_last_io, sizeof(trace_last_io), "%s=%c", topic + sizeof(MQTT_ROOT_TOPIC), length > 0 ? (char)payload[0] : '?');
+    return;
+  }
+  const char * number = strchr(tail, '/');
+  if (number == NULL)
+    return;
+  const char * what = strchr(number + 1, '/');
+  int n;
+  if (!MqttParse::toInt((const byte *)number + 1, what == NULL ? strlen(number + 1) : what - number - 1, n))
+    return;
+  TraceNode * node = trace_node(tail[0], n);
+  if (node == NULL)
+    return;
+
+  if (what == NULL)
+    node->online = MqttParse::equals(payload, length, "1");
+  else if (!strcmp(what, "/metrics"))
+    node->lps = trace_field(payload, length, "lps=");
+  else if (!strcmp(what, "/trace"))
+    node->latency = trace_field(payload, length, "hop=") + trace_field(payload, length, "proc=");
+}
+
+void setup_trace()
+{
+  display.setup();
+}
+
+/// TRACE loop : render the model to text, the display only sends the changed characters
+void trace_loop()
+{
+  if (trace_dirty)
+  {
+    trace_dirty = false;
+    char row[Ssd1306Text::COLS + 1];
+    snprintf(row, sizeof(row), "MDB MSG %u", trace_messages);
+    display.print(0, row);
+    for (byte i = 0; i < TRACE_MAX_NODES; i++)
     {
-      core_io_table[idx].input_status.start_millis = 0;
-      publish_output(core_io_table[idx].output_topic, false);
+      const TraceNode & node = trace_nodes[i];
+      if (i < trace_node_count)
+        snprintf(row, sizeof(row), "%c%-2u %-3s L%-5u %4ums", node.type, node.number, node.online ? "ON" : "OFF", node.lps, node.latency);
+      else
+        row[0] = 0;
+      display.print(1 + i, row);
     }
+    display.print(Ssd1306Text::ROWS - 1, trace_last_io);
+  }
+  display.loop();
 }
 
 #endif
@@ -841,6 +1861,7 @@ bool setup_network();//fwd
 // MQTT Client connect/reconnect
 void mqttClientConnect()
 {
+  unsigned long connect_millis = millis();
   // nb: our client name is our status topic
   char my_mqtt_status_topic[sizeof(MQTT_STATUS_PUBLISH_TOPIC) + 1];
   snprintf(my_mqtt_status_topic, sizeof(my_mqtt_status_topic), MQTT_STATUS_PUBLISH_TOPIC, getArduinoNumber());
@@ -856,7 +1877,8 @@ void mqttClientConnect()
 
     boolean r;
     // Publish status
-    r = mqttClient.publish(my_mqtt_status_topic, "1");
+    r = mqtt_publish(my_mqtt_status_topic, "1");
+    metrics.reconnects++;
 
     // Blink status
     blink.set(Blink::BlinkMode::blink_white);
@@ -871,8 +1893,15 @@ void mqttClientConnect()
 #ifdef MODE_CORE
     r = mqtt_core_subscribe(); // Very important for the core logic
 #endif
+#ifdef MODE_TRACE
+    r = mqtt_trace_subscribe();
+#endif
 
     Serial.print("subscribed: "); Serial.println(r);
+#ifdef MODE_CORE
+    // Retained messages storm
+    core_sync(my_mqtt_status_topic, connect_millis);
+#endif
     // Blink status
     blink.set(r ? Blink::BlinkMode::blink_white : Blink::BlinkMode::blink_fast);
   }
@@ -904,7 +1933,7 @@ void setup_common()
 
   // Open serial communications
   Serial.begin(115200);
-  Serial.print("@ Starting up... with ");  Serial.print(freeRam()); Serial.println(" free ram.");
+  Serial.print("@ Starting up... with ");  Serial.print(freeRam()); Serial.print(" free ram, "); Serial.print(flashUsed()); Serial.println(" bytes of flash used.");
 
   // Just blink a hello
   blink.set(Blink::BlinkMode::blink_whitetics);
@@ -918,11 +1947,13 @@ void setup_common()
   //delay(100); // 500us minimum
   //digitalWrite(PIN_RESET_NETWORK, HIGH);
 
+#ifndef WITHOUT_NETWORK
   // Setting up the network
   while (!setup_network())
   { 
     blink.loop();
   }
+#endif
 }
 
 // Test if ethernet status is ok (could reset with more sensitivity than the arduino, in case of brown-out
@@ -972,6 +2003,154 @@ bool setup_network()
   return true;
 }
 
+// MEMORY -----------------------------------------------------------------
+#define MEMORY_SCAN_MS 1000
+#define MEMORY_PUBLISH_MS 60000
+#define MQTT_MEMORY_SUFFIX "/mem"
+
+// Update the memory high water marks, and publish them on ROOT/STATUS/TYPE/<n>/mem
+void memory_loop()
+{
+  static unsigned long scan_millis = 0;
+  static unsigned long publish_millis = 0;
+
+  if (millis() - scan_millis < MEMORY_SCAN_MS)
+    return;
+  scan_millis = millis();
+  MemoryWatch::scan();
+
+  if (millis() - publish_millis < MEMORY_PUBLISH_MS || !mqttClient.connected())
+    return;
+  publish_millis = millis();
+
+  char topic[sizeof(MQTT_STATUS_PUBLISH_TOPIC MQTT_MEMORY_SUFFIX) + 1];
+  snprintf(topic, sizeof(topic), MQTT_STATUS_PUBLISH_TOPIC MQTT_MEMORY_SUFFIX, getArduinoNumber());
+  char payload[56];
+  snprintf(payload, sizeof(payload), "free=%d min_free=%d stack_max=%d heap_max=%d",
+           freeRam(), MemoryWatch::minFree(), MemoryWatch::stackMax(), MemoryWatch::heapMax());
+  mqtt_publish(topic, payload);
+}
+
+// METRICS ----------------------------------------------------------------
+#define METRICS_PUBLISH_MS 60000
+#define MQTT_METRICS_SUFFIX "/metrics"
+
+// Publish the counters on ROOT/STATUS/TYPE/<n>/metrics, as rates per second over the period
+/// Metrics message : the fields are appended whole, and published in several messages if needed
+/// (each one within the MQTT packet, and starting with up=<sec> to join them)
+struct MetricsPayload {
+  /// MQTT packet, less the fixed header (5), the topic length (2) and the topic ; bounded for the stack
+  static const int MAX = min(MQTT_MAX_PACKET_SIZE - 5 - 2 - (int)sizeof(MQTT_STATUS_PUBLISH_TOPIC MQTT_METRICS_SUFFIX), 200);
+
+  const char * topic;
+  char text[MAX + 1];
+  int len;
+
+  MetricsPayload(const char * topic) : topic(topic), len(0) {}
+
+  void append(const char * format, ...)
+  {
+    for (byte attempt = 0; attempt < 2; attempt++)
+    {
+      va_list args;
+      va_start(args, format);
+      int n = vsnprintf(text + len, sizeof(text) - len, format, args);
+      va_end(args);
+      if (n >= 0 && len + n < (int)sizeof(text))
+      {
+        len += n;
+        return;
+      }
+      // does not fit : the field goes to the next message (dropped if longer than a message)
+      text[len] = 0;
+      if (attempt == 0)
+        publish();
+    }
+  }
+
+  /// Publish the fields appended, and start a new message
+  void publish()
+  {
+    mqtt_publish(topic, text);
+    len = snprintf(text, sizeof(text), "up=%lu", millis() / 1000);
+  }
+};
+
+void metrics_loop()
+{
+  static unsigned long publish_millis = 0;
+  unsigned long elapsed = millis() - publish_millis;
+  if (elapsed < METRICS_PUBLISH_MS || !mqttClient.connected())
+    return;
+  publish_millis = millis();
+
+  char topic[sizeof(MQTT_STATUS_PUBLISH_TOPIC MQTT_METRICS_SUFFIX) + 1];
+  snprintf(topic, sizeof(topic), MQTT_STATUS_PUBLISH_TOPIC MQTT_METRICS_SUFFIX, getArduinoNumber());
+  MetricsPayload payload(topic);
+  payload.append("up=%lu lps=%lu sps=%lu in=%u out=%u fail=%u reconn=%u min_free=%d",
+                 millis() / 1000, metrics.loops / (elapsed / 1000), metrics.scans / (elapsed / 1000),
+                 metrics.messages_in, metrics.messages_out, metrics.publish_failures, metrics.reconnects, MemoryWatch::minFree());
+#ifdef WITH_BUFFERED_CLIENT
+  // writes to the W5x00 (compare with out=)
+  payload.append(" wr=%u wr_err=%u", bufferedClient.flushes, bufferedClient.writeErrors);
+  bufferedClient.flushes = 0;
+#endif
+  payload.append(" backlog=%u drain_ex=%u", metrics.backlog_max, metrics.drain_exhausted);
+#ifdef MODE_INPUT
+  payload.append(" scan_gap=%u", metrics.scan_gap_max);
+#ifdef WITH_PULSE
+  // longest sampling interrupt (us)
+  if (pulse_sampler.running())
+    payload.append(" pulse_isr=%u", pulse_sampler.isrMax);
+  pulse_sampler.isrMax = 0;
+#endif
+#endif
+#ifdef MODE_OUTPUT
+  payload.append(" latches=%u", metrics.latches);
+#ifdef WITH_DIMMER
+  // longest interrupt (us), interrupts share of the cpu (%)
+  payload.append(" bcm_isr=%u bcm_load=%u", output_dimmer.isrMax / ShiftDimmer::TICKS_PER_US, output_dimmer.load());
+  output_dimmer.isrMax = 0;
+#endif
+#endif
+#ifdef MODE_TRACE
+  payload.append(" i2c=%lu", display.bytesSent);
+#endif
+#ifdef WITH_DS18
+  payload.append(" ds18_err=%u ds18_step=%lu", DS18X::readErrors, DS18X::stepMax);
+#endif
+#ifdef MODE_CORE
+  int moving = 0;
+#ifdef WITH_COVER
+  for (int idx = 0; cover_table[idx].topic_cover != NULL; idx++)
+    moving += cover_table[idx].status_up || cover_table[idx].status_dw;
+#endif
+  payload.append(" moving=%d", moving);
+#ifdef WITH_TRACE
+  payload.append(" lost=%u", Trace::lost);
+#endif
+#ifdef WITH_INPUT_STATE
+  payload.append(" in_fix=%u", input_state.fixes);
+#endif
+#endif
+#if defined WITH_TRACE && !defined MODE_INPUT
+  // latency distribution of the period (hop + proc)
+  // nb: one field, never split between two messages
+  char lat[Trace::BUCKETS * 6 + 1];
+  int latLength = 0;
+  for (byte b = 0; b < Trace::BUCKETS; b++)
+    latLength += snprintf(lat + latLength, sizeof(lat) - latLength, b ? ",%u" : "%u", Trace::histogram[b]);
+  payload.append(" lat=%s", lat);
+  memset(Trace::histogram, 0, sizeof(Trace::histogram));
+#endif
+  payload.publish();
+
+  // new period (the reconnects are kept)
+  unsigned int reconnects = metrics.reconnects;
+  memset(&metrics, 0, sizeof(metrics));
+  metrics.reconnects = reconnects;
+}
+
 // COMMON LOOP ------------------------------------------------------------
 void common_loop()
 {
@@ -981,6 +2160,20 @@ void common_loop()
 #ifdef MODE_CORE
   core_loop();
 #endif
+#ifdef MODE_OUTPUT
+  output_loop();
+#endif
+#ifdef MODE_TRACE
+  trace_loop();
+#endif
+#ifdef MODE_SENSOR
+  sensor_loop();
+#endif
+
+  // memory high water marks
+  memory_loop();
+  // counters
+  metrics_loop();
 
   // animate status
   blink.loop();
@@ -989,6 +2182,10 @@ void common_loop()
 // ONE TIME INIT ----------------------------------------------------------
 void setup()
 {
+#ifdef MODE_OUTPUT
+  setup_output_restore();
+#endif
+
   setup_common();
 
 #ifdef MODE_INPUT
@@ -999,15 +2196,76 @@ void setup()
   setup_core();
 #endif
 
+#ifdef MODE_TRACE
+  setup_trace();
+#endif
+
+#ifdef MODE_SENSOR
+  setup_sensor();
+#endif
+
 #ifdef MODE_OUTPUT
-  // Setup outpin pins for shift registers
-  outputShiftRegister.setup();
+  // nb: before the bench, which needs the topic prefix
+  setup_output();
+#endif
+
+#ifdef WITH_REPLAY
+  Replay::setup(MqttMessageCallback, common_loop, core_dump, core_replay_sync);
+#endif
+
+#ifdef WITH_BENCH
+  Bench::common();
+#ifdef MODE_OUTPUT
+  output_bench();
+#endif
+#ifdef MODE_CORE
+  core_bench();
+#endif
+#ifdef WITH_DS18
+  ds18_bench();
+#endif
+  Serial.println("BENCH,done");
 #endif
 }
 
+// MQTT DRAIN -----------------------------------------------------------
+/// Incoming bytes waiting
+int mqtt_available()
+{
+#ifdef WITH_BUFFERED_CLIENT
+  return bufferedClient.available();
+#else
+  return ethClient.available();
+#endif
+}
+
+/// Handle the incoming messages (one per mqttClient.loop()) until none is left or the time budget is spent :
+/// a burst is absorbed at once, and the scans of the next loop are late by the budget at most
+void mqtt_drain()
+{
+  unsigned long start = micros();
+  unsigned int backlog = mqtt_available();
+  metrics.backlog_max = max(metrics.backlog_max, backlog);
+  while (mqttClient.loop() && mqtt_available() > 0 && micros() - start < MQTT_DRAIN_BUDGET_US)
+    ;
+
+  if (mqttClient.connected() && mqtt_available() > 0)
+    metrics.drain_exhausted++;
+}
+
 // NORMAL LOOP ----------------------------------------------------------
 void loop()
 {
+  metrics.loops++;
+
+#ifdef WITH_REPLAY
+  // the replay drives the logic on its virtual clock
+  Replay::loop();
+#endif
+#ifdef WITHOUT_NETWORK
+  return;
+#endif
+
   // animate status
   blink.loop();
 
@@ -1019,5 +2277,10 @@ void loop()
   common_loop();
 
   // MQTT Loop
-  mqttClient.loop();
+  mqtt_drain();
+
+#ifdef WITH_BUFFERED_CLIENT
+  // send what this loop published
+  bufferedClient.flush();
+#endif
 }